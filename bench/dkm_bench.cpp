@@ -0,0 +1,326 @@
+// Standalone benchmarks for the dkm k-means functions used by the app, with no openFrameworks
+// dependency. Prints one JSON document to stdout; see bench/Makefile.
+//
+//   dkm_bench [--quick] [--repeats R] [--seed S] [--threads T]
+//
+// Every (function, distribution, n, k, N) case is timed `repeats` times after one warm-up call, and
+// reports the fastest and median times per data point along with the heap allocations made per call.
+// Multi-threaded cases also report their thread count and median speedup over the serial equivalent.
+
+#include "dkm.hpp"
+#include "dkm_parallel.hpp"
+#include "dkm_coreset.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Count every heap allocation made by the process
+namespace {
+std::atomic<uint64_t> allocationCount { 0 };
+std::atomic<uint64_t> allocatedBytes { 0 };
+}
+
+void* operator new(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+struct Options {
+  bool quick { false };
+  int repeats { 5 };
+  uint64_t seed { 1000 };
+  size_t threads { std::thread::hardware_concurrency() };
+};
+
+enum class Distribution { uniform, blobs, pitchRms };
+
+const char* distributionName(Distribution distribution) {
+  switch (distribution) {
+    case Distribution::uniform: return "uniform";
+    case Distribution::blobs: return "blobs";
+    case Distribution::pitchRms: return "pitch_rms";
+  }
+  return "";
+}
+
+float clamp01(float x) { return std::min(1.0f, std::max(0.0f, x)); }
+
+// Synthetic notes shaped like the app's normalised (pitch, RMS, ...) samples: runs of near-duplicate
+// samples while a note is held, with pitches on an equal tempered scale between the app's default
+// minPitch and maxPitch, and RMS decaying through each note. Any further dimensions loosely follow pitch.
+template <size_t N>
+std::vector<std::array<float, N>> makePitchRmsData(size_t n, std::mt19937_64& rng) {
+  const float minPitch = 150.0, maxPitch = 1500.0;
+  std::vector<float> scale;
+  for (float f = 110.0; f < maxPitch; f *= std::pow(2.0f, 1.0f / 12.0f)) {
+    if (f >= minPitch) scale.push_back(f);
+  }
+  std::uniform_int_distribution<size_t> scaleIndex(0, scale.size() - 1);
+  std::geometric_distribution<int> heldSamples(1.0 / 40.0);
+  std::gamma_distribution<float> attack(2.0, 0.2);
+  std::normal_distribution<float> jitter(0.0, 1.0);
+
+  std::vector<std::array<float, N>> data;
+  data.reserve(n);
+  while (data.size() < n) {
+    float pitch = scale[scaleIndex(rng)];
+    float level = clamp01(attack(rng));
+    int held = 1 + heldSamples(rng);
+    for (int i = 0; i < held && data.size() < n; i++) {
+      std::array<float, N> point;
+      float vibrato = pitch * (1.0f + 0.005f * jitter(rng));
+      point[0] = clamp01((vibrato - minPitch) / (maxPitch - minPitch));
+      point[1] = clamp01(level * std::exp(-0.05f * i) + 0.01f * jitter(rng));
+      for (size_t d = 2; d < N; d++) {
+        point[d] = clamp01(0.5f * point[0] + 0.25f + 0.05f * jitter(rng));
+      }
+      data.push_back(point);
+    }
+  }
+  return data;
+}
+
+template <size_t N>
+std::vector<std::array<float, N>> makeData(Distribution distribution, size_t n, std::mt19937_64& rng) {
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::vector<std::array<float, N>> data(n);
+  switch (distribution) {
+    case Distribution::uniform:
+      for (auto& point : data) {
+        for (auto& x : point) x = uniform(rng);
+      }
+      break;
+    case Distribution::blobs: {
+      std::vector<std::array<float, N>> centres(40);
+      for (auto& centre : centres) {
+        for (auto& x : centre) x = uniform(rng);
+      }
+      std::uniform_int_distribution<size_t> centreIndex(0, centres.size() - 1);
+      std::normal_distribution<float> spread(0.0, 0.03);
+      for (auto& point : data) {
+        const auto& centre = centres[centreIndex(rng)];
+        for (size_t d = 0; d < N; d++) point[d] = clamp01(centre[d] + spread(rng));
+      }
+      break;
+    }
+    case Distribution::pitchRms:
+      data = makePitchRmsData<N>(n, rng);
+      break;
+  }
+  return data;
+}
+
+struct Measurement {
+  double nsPerPointMin;
+  double nsPerPointMedian;
+  double allocations;
+  double allocatedBytes;
+};
+
+template <typename F>
+Measurement measure(const Options& options, size_t n, F&& f) {
+  f(); // warm up, and let in-place functions size their outputs
+  std::vector<double> times;
+  times.reserve(options.repeats);
+  uint64_t count = allocationCount, bytes = allocatedBytes;
+  for (int r = 0; r < options.repeats; r++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto stop = std::chrono::steady_clock::now();
+    times.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / n);
+  }
+  Measurement m;
+  m.allocations = double(allocationCount - count) / options.repeats;
+  m.allocatedBytes = double(allocatedBytes - bytes) / options.repeats;
+  std::sort(times.begin(), times.end());
+  m.nsPerPointMin = times.front();
+  m.nsPerPointMedian = times[times.size() / 2];
+  return m;
+}
+
+bool firstResult = true;
+
+// serial, if given, is the measurement of the serial equivalent of a multi-threaded function
+void printResult(const char* function, Distribution distribution, size_t n, uint32_t k, size_t dims, const Options& options, const Measurement& m,
+                 const Measurement* serial = nullptr) {
+  std::printf("%s\n    {\"function\": \"%s\", \"distribution\": \"%s\", \"n\": %zu, \"k\": %u, \"dims\": %zu, \"repeats\": %d, "
+              "\"ns_per_point_min\": %.3f, \"ns_per_point_median\": %.3f, \"allocations\": %.1f, \"allocated_bytes\": %.0f",
+              firstResult ? "" : ",", function, distributionName(distribution), n, k, dims, options.repeats,
+              m.nsPerPointMin, m.nsPerPointMedian, m.allocations, m.allocatedBytes);
+  if (serial) {
+    std::printf(", \"threads\": %zu, \"speedup\": %.2f", options.threads, serial->nsPerPointMedian / m.nsPerPointMedian);
+  }
+  std::printf("}");
+  firstResult = false;
+  std::fflush(stdout);
+}
+
+template <size_t N>
+void benchmarkCase(const Options& options, dkm::thread_pool& pool, Distribution distribution, size_t n, uint32_t k) {
+  std::mt19937_64 rng(options.seed + n * 131 + k * 7 + N);
+  auto data = makeData<N>(distribution, n, rng);
+
+  dkm::clustering_parameters<float> parameters { k };
+  parameters.set_random_seed(options.seed);
+
+  {
+    std::vector<std::array<float, N>> means;
+    std::vector<float> distances;
+    Measurement m = measure(options, n, [&] { dkm::details::random_plusplus(data, k, options.seed, means, distances); });
+    printResult("random_plusplus", distribution, n, k, N, options, m);
+  }
+
+  {
+    std::vector<std::array<float, N>> means;
+    std::vector<double> proposal;
+    Measurement m = measure(options, n, [&] { dkm::details::random_afk_mc2(data, k, 200, options.seed, means, proposal); });
+    printResult("random_afk_mc2", distribution, n, k, N, options, m);
+  }
+
+  auto means = dkm::details::random_plusplus(data, k, options.seed);
+  auto clusters = dkm::details::calculate_clusters(data, means);
+  {
+    Measurement m = measure(options, n, [&] { clusters = dkm::details::calculate_clusters(data, means); });
+    printResult("calculate_clusters", distribution, n, k, N, options, m);
+  }
+  {
+    std::vector<std::array<float, N>> newMeans;
+    Measurement m = measure(options, n, [&] { newMeans = dkm::details::calculate_means(data, clusters, means, k); });
+    printResult("calculate_means", distribution, n, k, N, options, m);
+  }
+  {
+    Measurement m = measure(options, n, [&] { auto results = dkm::kmeans_lloyd(data, parameters); (void)results; });
+    printResult("kmeans_lloyd", distribution, n, k, N, options, m);
+  }
+  Measurement lloyd;
+  {
+    dkm::kmeans_workspace<float, N> workspace;
+    std::vector<std::array<float, N>> lloydMeans;
+    std::vector<uint32_t> lloydClusters;
+    lloyd = measure(options, n, [&] { dkm::kmeans_lloyd(data, parameters, workspace, lloydMeans, lloydClusters); });
+    printResult("kmeans_lloyd_workspace", distribution, n, k, N, options, lloyd);
+  }
+  {
+    dkm::kmeans_workspace<float, N> workspace;
+    std::vector<std::array<float, N>> hamerlyMeans;
+    std::vector<uint32_t> hamerlyClusters;
+    Measurement m = measure(options, n, [&] { dkm::kmeans_hamerly(data, parameters, workspace, hamerlyMeans, hamerlyClusters); });
+    printResult("kmeans_hamerly", distribution, n, k, N, options, m);
+  }
+  {
+    dkm::kmeans_workspace<float, N> workspace;
+    std::vector<std::array<float, N>> elkanMeans;
+    std::vector<uint32_t> elkanClusters;
+    Measurement m = measure(options, n, [&] { dkm::kmeans_elkan(data, parameters, workspace, elkanMeans, elkanClusters); });
+    printResult("kmeans_elkan", distribution, n, k, N, options, m);
+  }
+  {
+    std::vector<std::array<float, N>> parallelMeans;
+    std::vector<uint32_t> parallelClusters;
+    Measurement m = measure(options, n, [&] { dkm::kmeans_lloyd_parallel(data, parameters, pool, parallelMeans, parallelClusters); });
+    printResult("kmeans_lloyd_parallel", distribution, n, k, N, options, m, &lloyd);
+  }
+  {
+    dkm::parallel_kmeans_workspace<float, N> workspace;
+    std::vector<std::array<float, N>> parallelMeans;
+    std::vector<uint32_t> parallelClusters;
+    Measurement m = measure(options, n, [&] { dkm::kmeans_lloyd_parallel(data, parameters, pool, workspace, parallelMeans, parallelClusters); });
+    printResult("kmeans_lloyd_parallel_workspace", distribution, n, k, N, options, m, &lloyd);
+  }
+  {
+    // the app's steady state: a seeded clusterer re-assigning a pass over the window
+    dkm::kmeans_streaming<float, N> streaming { parameters };
+    std::vector<uint32_t> labels;
+    streaming.seed(data, labels);
+    Measurement m = measure(options, n, [&] { streaming.refine(data, labels, n); });
+    printResult("kmeans_streaming_refine", distribution, n, k, N, options, m);
+  }
+  {
+    // roughly 4k cells however many dimensions, as the app's 64x64 grid in 2D
+    const uint32_t cellsPerDimension = N == 2 ? 64 : N == 3 ? 16 : 8;
+    dkm::grid_coreset<float, N> coreset { cellsPerDimension };
+    dkm::kmeans_workspace<float, N> workspace;
+    std::vector<std::array<float, N>> coresetMeans;
+    std::vector<uint32_t> coresetLabels, labels;
+    Measurement m = measure(options, n, [&] {
+      coreset.build(data);
+      if (coreset.points().size() < k) return; // too few occupied cells to cluster
+      dkm::kmeans_lloyd(coreset.points(), coreset.weights(), parameters, workspace, coresetMeans, coresetLabels);
+      coreset.expand_labels(coresetLabels, labels);
+    });
+    printResult("grid_coreset_kmeans", distribution, n, k, N, options, m);
+  }
+}
+
+template <size_t N>
+void benchmarkDimension(const Options& options, dkm::thread_pool& pool) {
+  std::vector<size_t> ns = options.quick ? std::vector<size_t> { 1000, 12000 } : std::vector<size_t> { 1000, 4000, 12000, 24000, 48000 };
+  std::vector<uint32_t> ks = options.quick ? std::vector<uint32_t> { 2, 17 } : std::vector<uint32_t> { 2, 8, 17, 30, 60 };
+  for (Distribution distribution : { Distribution::uniform, Distribution::blobs, Distribution::pitchRms }) {
+    for (size_t n : ns) {
+      for (uint32_t k : ks) {
+        benchmarkCase<N>(options, pool, distribution, n, k);
+      }
+    }
+  }
+}
+
+const char* simdName() {
+#if defined(DKM_NO_SIMD)
+  return "none";
+#elif defined(__x86_64__) || defined(_M_X64)
+  return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  return "neon";
+#else
+  return "portable";
+#endif
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--quick") == 0) {
+      options.quick = true;
+    } else if (std::strcmp(argv[i], "--repeats") == 0 && i + 1 < argc) {
+      options.repeats = std::max(1, std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      options.threads = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::fprintf(stderr, "usage: %s [--quick] [--repeats R] [--seed S] [--threads T]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::printf("{\n  \"benchmark\": \"dkm\",\n  \"compiler\": \"%s\",\n  \"simd\": \"%s\",\n  \"results\": [", __VERSION__, simdName());
+  dkm::thread_pool pool(std::max<size_t>(1, options.threads));
+  benchmarkDimension<2>(options, pool);
+  benchmarkDimension<3>(options, pool);
+  benchmarkDimension<4>(options, pool);
+  std::printf("\n  ]\n}\n");
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include "ClusterMemberIndex.h"
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+void ClusterMemberIndex::setup(size_t capacityPerCluster) {
+  assert(capacityPerCluster > 0);
+  capacity = capacityPerCluster;
+  seqs.clear();
+  heads.clear();
+  counts.clear();
+  staleCount = 0;
+}
+
+void ClusterMemberIndex::grow(uint32_t cluster) {
+  if (cluster < heads.size()) return;
+  seqs.resize((cluster + 1) * capacity);
+  heads.resize(cluster + 1, 0);
+  counts.resize(cluster + 1, 0);
+}
+
+void ClusterMemberIndex::add(uint32_t cluster, uint64_t seq) {
+  if (cluster == NoteHistory::noLabel) return;
+  grow(cluster);
+  assert(counts[cluster] == 0 || at(cluster, counts[cluster] - 1) < seq);
+  seqs[cluster * capacity + heads[cluster]] = seq; // overwrites the oldest when full
+  heads[cluster] = (heads[cluster] + 1) % capacity;
+  if (counts[cluster] < capacity) counts[cluster]++;
+}
+
+void ClusterMemberIndex::move(uint64_t seq, uint32_t from, uint32_t to) {
+  if (from != NoteHistory::noLabel) staleCount++;
+  grow(to);
+  size_t& count = counts[to];
+  // moved notes tend to be old, so search back from the newest for where this one belongs
+  size_t i = count;
+  while (i > 0 && at(to, i - 1) > seq) i--;
+  if (i > 0 && at(to, i - 1) == seq) return; // moved back to a cluster that still lists it
+  if (count == capacity) {
+    if (i == 0) return; // older than everything kept
+    count--; // drop the oldest
+    i--;
+  }
+  add(to, std::numeric_limits<uint64_t>::max()); // make room at the end
+  for (size_t j = count - 1; j > i; j--) at(to, j) = at(to, j - 1);
+  at(to, i) = seq;
+}
+
+void ClusterMemberIndex::refresh(const NoteHistory& history) {
+  if (staleCount > capacity) rebuild(history);
+}
+
+void ClusterMemberIndex::rebuild(const NoteHistory& history) {
+  rebuildFrom(history, history.getFirstSeq());
+}
+
+void ClusterMemberIndex::rebuildRecent(const NoteHistory& history) {
+  rebuildFrom(history, history.getEndSeq() - std::min<uint64_t>(capacity, history.size()));
+}
+
+void ClusterMemberIndex::rebuildFrom(const NoteHistory& history, uint64_t firstSeq) {
+  std::fill(counts.begin(), counts.end(), 0);
+  std::fill(heads.begin(), heads.end(), 0);
+  staleCount = 0;
+  for (uint64_t seq = firstSeq; seq < history.getEndSeq(); seq++) {
+    add(history.label(seq), seq);
+  }
+  rebuildCount++;
+}
+
+void ClusterMemberIndex::latest(const NoteHistory& history, uint32_t cluster, uint64_t firstSeq, size_t maxCount, std::vector<uint64_t>& result) const {
+  result.clear();
+  if (cluster >= heads.size()) return;
+  const uint64_t* ring = seqs.data() + cluster * capacity;
+  size_t i = heads[cluster];
+  for (size_t n = 0; n < counts[cluster] && result.size() < maxCount; n++) {
+    i = (i + capacity - 1) % capacity;
+    uint64_t seq = ring[i];
+    if (seq < firstSeq || !history.contains(seq)) break; // everything further back is older still
+    if (history.label(seq) == cluster) result.push_back(seq); // skip notes that have since moved to another cluster
+  }
+}
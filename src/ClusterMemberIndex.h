@@ -0,0 +1,43 @@
+#pragma once
+
+#include "NoteHistory.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The most recent members of each cluster, as bounded lists of note sequence numbers in recency order,
+// so "the latest notes of cluster c" is a walk along one list rather than a scan of the note history.
+// Entries aren't removed when a note is evicted or moves to another cluster; they are skipped when read,
+// and the lists are rebuilt from the history when the labelling is replaced or too many have gone stale.
+class ClusterMemberIndex {
+public:
+  void setup(size_t capacityPerCluster);
+
+  // Record a newly labelled note, which must be newer than any note already recorded for its cluster
+  void add(uint32_t cluster, uint64_t seq);
+  // Record a note that has been relabelled, in recency order among its new cluster's members
+  void move(uint64_t seq, uint32_t from, uint32_t to);
+  // Rebuild if too many entries have gone stale, once the labels are up to date
+  void refresh(const NoteHistory& history);
+  void rebuild(const NoteHistory& history);
+  // Rebuild from only the newest capacityPerCluster notes, which is all that latest() needs when it
+  // goes back no further than those; for relabellings that touch most of the window
+  void rebuildRecent(const NoteHistory& history);
+
+  // Fill result with up to maxCount members of the cluster, newest first, going back no further than firstSeq
+  void latest(const NoteHistory& history, uint32_t cluster, uint64_t firstSeq, size_t maxCount, std::vector<uint64_t>& result) const;
+
+  size_t getRebuildCount() const { return rebuildCount; }
+
+private:
+  void grow(uint32_t cluster);
+  void rebuildFrom(const NoteHistory& history, uint64_t firstSeq);
+  uint64_t& at(uint32_t cluster, size_t i) { return seqs[cluster * capacity + (heads[cluster] + capacity - counts[cluster] + i) % capacity]; } // i from 0, the oldest
+
+  size_t capacity { 0 };
+  std::vector<uint64_t> seqs; // capacity entries per cluster, each a ring
+  std::vector<size_t> heads; // where the next entry goes in each cluster's ring
+  std::vector<size_t> counts;
+  size_t staleCount { 0 }; // entries left behind by notes that moved cluster
+  size_t rebuildCount { 0 };
+};
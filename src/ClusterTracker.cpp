@@ -0,0 +1,95 @@
+#include "ClusterTracker.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+ClusterTracker::Match ClusterTracker::match(float x, float y, float tolerance_) {
+  setTolerance(tolerance_);
+  uint32_t cx = cellCoordinate(x), cy = cellCoordinate(y);
+
+  // anything within the match radius is in this cell or a neighbouring one
+  uint32_t best = std::numeric_limits<uint32_t>::max();
+  auto consider = [&](uint32_t index) {
+    float dx = xs[index] - x, dy = ys[index] - y;
+    if (index < best && dx * dx + dy * dy < tolerance) best = index;
+  };
+  uint32_t firstColumn = cx > 0 ? cx - 1 : 0, endColumn = std::min(cx + 2, cellsPerSide);
+  for (uint32_t row = cy > 0 ? cy - 1 : 0; row < std::min(cy + 2, cellsPerSide); row++) {
+    uint32_t end = cellStarts[row * cellsPerSide + endColumn];
+    for (uint32_t i = cellStarts[row * cellsPerSide + firstColumn]; i < end; i++) consider(sorted[i]);
+  }
+  for (uint32_t index : unsorted) consider(index); // a moved centre may also have a stale sorted entry, which is harmless
+
+  uint32_t cell = cy * cellsPerSide + cx;
+  if (best == std::numeric_limits<uint32_t>::max()) {
+    uint32_t index = xs.size();
+    xs.push_back(x);
+    ys.push_back(y);
+    ages.push_back(5.0);
+    cellIndices.push_back(cell);
+    unsorted.push_back(index);
+    return { index, true };
+  }
+
+  // close to an existing one, so move a little towards the new one, and age it to preserve it
+  xs[best] = x + (xs[best] - x) * 0.3f;
+  ys[best] = y + (ys[best] - y) * 0.3f;
+  ages[best]++;
+  uint32_t newCell = cellCoordinate(ys[best]) * cellsPerSide + cellCoordinate(xs[best]);
+  if (newCell != cellIndices[best]) {
+    cellIndices[best] = newCell;
+    unsorted.push_back(best);
+  }
+  return { best, false };
+}
+
+void ClusterTracker::decay(float rate) {
+  centres.clear();
+  std::fill(cellStarts.begin(), cellStarts.end(), 0);
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < xs.size(); i++) {
+    float age = ages[i] * rate;
+    if (age <= 1.0) continue;
+    xs[kept] = xs[i];
+    ys[kept] = ys[i];
+    ages[kept] = age;
+    cellIndices[kept] = cellIndices[i];
+    cellStarts[cellIndices[kept] + 1]++;
+    centres.push_back({ xs[kept], ys[kept], 0.0, age });
+    kept++;
+  }
+  xs.resize(kept);
+  ys.resize(kept);
+  ages.resize(kept);
+  cellIndices.resize(kept);
+
+  // counting sort by cell, which keeps each cell in index order
+  for (size_t c = 1; c < cellStarts.size(); c++) cellStarts[c] += cellStarts[c - 1];
+  sorted.resize(kept);
+  for (uint32_t i = 0; i < kept; i++) sorted[cellStarts[cellIndices[i]]++] = i;
+  std::rotate(cellStarts.rbegin(), cellStarts.rbegin() + 1, cellStarts.rend()); // back to the starts
+  cellStarts[0] = 0;
+  unsorted.clear();
+}
+
+void ClusterTracker::setTolerance(float tolerance_) {
+  if (tolerance_ == tolerance) return;
+  tolerance = tolerance_;
+  float radius = std::sqrt(std::max(tolerance, 0.0f));
+  cellsPerSide = radius > 0.0 ? std::clamp<float>(std::floor(1.0 / radius), 1, 256) : 256;
+  cellSize = 1.0 / cellsPerSide; // rounded up to fit the unit square, so never smaller than the match radius
+  rebuildGrid();
+}
+
+uint32_t ClusterTracker::cellCoordinate(float x) const {
+  // clamp to the grid, with the negated comparison also sending NaN to the first cell
+  return !(x > 0.0) ? 0 : std::min<uint32_t>(std::min(x / cellSize, float(cellsPerSide)), cellsPerSide - 1);
+}
+
+void ClusterTracker::rebuildGrid() {
+  cellStarts.resize(cellsPerSide * cellsPerSide + 1);
+  for (uint32_t i = 0; i < xs.size(); i++) {
+    cellIndices[i] = cellCoordinate(ys[i]) * cellsPerSide + cellCoordinate(xs[i]);
+  }
+  decay(1.0); // nothing fades at this rate that hasn't already been culled
+}
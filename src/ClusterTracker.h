@@ -0,0 +1,52 @@
+#pragma once
+
+#include "glm/vec4.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Long-lived cluster centres that follow the k-means means from frame to frame.
+// Each new mean either matches the first (lowest index) tracked centre within the tolerance, which moves
+// towards it and ages, or starts a new centre; every frame all centres decay and the faded ones are culled.
+// Centres are kept as columns, bucketed into a uniform grid over the unit square so matching only looks
+// at the neighbouring cells. Cells are at least the match radius across, which is sqrt(tolerance) because
+// the tolerance is compared against the squared distance.
+class ClusterTracker {
+public:
+  struct Match {
+    uint32_t index;
+    bool created;
+  };
+
+  Match match(float x, float y, float tolerance);
+  // Decay every centre, cull those that have faded and rebuild the grid and getCentres(), in one pass
+  void decay(float rate);
+
+  size_t size() const { return xs.size(); }
+  float getX(uint32_t i) const { return xs[i]; }
+  float getY(uint32_t i) const { return ys[i]; }
+  float getAge(uint32_t i) const { return ages[i]; } // grows while matched, decays always
+  // (x, y, 0, age) for each centre, as of the last decay
+  const std::vector<glm::vec4>& getCentres() const { return centres; }
+
+private:
+  void setTolerance(float tolerance);
+  uint32_t cellCoordinate(float x) const;
+  void rebuildGrid();
+
+  std::vector<float> xs;
+  std::vector<float> ys;
+  std::vector<float> ages;
+  std::vector<uint32_t> cellIndices; // the grid cell each centre is in
+
+  float tolerance { -1.0 };
+  float cellSize { 1.0 };
+  uint32_t cellsPerSide { 1 };
+  // Centre indices sorted by cell, so each row of neighbouring cells is one contiguous range.
+  // Centres created or moved to another cell since the last rebuild are in `unsorted` instead.
+  std::vector<uint32_t> cellStarts = std::vector<uint32_t>(2); // cellsPerSide^2 + 1, so decay() works before any match()
+  std::vector<uint32_t> sorted;
+  std::vector<uint32_t> unsorted;
+
+  std::vector<glm::vec4> centres;
+};
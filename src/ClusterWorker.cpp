@@ -0,0 +1,114 @@
+#include "ClusterWorker.h"
+#include <numeric>
+#include <sstream>
+
+std::string toString(const dkm::clustering_stats& stats) {
+  static const char* reasons[] = { "converged", "cycled", "min delta", "max iterations", "deadline" };
+  std::ostringstream ss;
+  ss << "kmeans: " << stats.iterations << " iterations in "
+     << std::chrono::duration<float, std::milli>(stats.elapsed).count() << "ms, "
+     << reasons[static_cast<int>(stats.reason)] << ", inertia " << stats.inertia;
+  return ss.str();
+}
+
+dkm::clustering_stats NoteCoresetClusterer::clusterCoreset(const dkm::clustering_parameters<float>& params, std::vector<std::array<float, 2>>& means) {
+  dkm::clustering_stats stats {};
+  if (coreset.size() > params.get_k()) {
+    stats = dkm::kmeans_lloyd(coreset.points(), coreset.weights(), params, workspace, means, coresetLabels);
+  } else {
+    // too few occupied cells to make k clusters, so each cell is its own cluster
+    means = coreset.points();
+    coresetLabels.resize(coreset.size());
+    std::iota(coresetLabels.begin(), coresetLabels.end(), 0);
+  }
+  return stats;
+}
+
+ClusterWorker::ClusterWorker(dkm::thread_pool& threadPool_) :
+threadPool(threadPool_),
+thread([this] { run(); })
+{}
+
+ClusterWorker::~ClusterWorker() {
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    stopping = true;
+  }
+  jobAvailable.notify_one();
+  thread.join();
+}
+
+bool ClusterWorker::submit(const NoteHistory::PointView<2>& notes, uint64_t firstSeq, const dkm::clustering_parameters<float>& params, bool coreset, uint32_t coresetCells, uint64_t frame) {
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    if (jobPending || running) {
+      skippedCount++;
+      return false;
+    }
+  }
+  // the worker leaves pendingJob alone until jobPending is set, so the copy needn't hold the lock
+  pendingJob.notes.resize(notes.size());
+  for (size_t i = 0; i < notes.size(); i++) pendingJob.notes[i] = notes[i];
+  pendingJob.firstSeq = firstSeq;
+  pendingJob.params = params;
+  pendingJob.coreset = coreset;
+  pendingJob.coresetCells = coresetCells;
+  pendingJob.frame = frame;
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    jobPending = true;
+  }
+  submittedCount++;
+  jobAvailable.notify_one();
+  return true;
+}
+
+const ClusterWorker::Result* ClusterWorker::fetchResult(uint64_t frame) {
+  if ((sharedIndex.load(std::memory_order_acquire) & freshBit) == 0) return nullptr;
+  readIndex = sharedIndex.exchange(readIndex, std::memory_order_acq_rel) & ~freshBit;
+  const Result& result = results[readIndex];
+  latencyFrames = frame - result.frame;
+  maxLatencyFrames = std::max(maxLatencyFrames, latencyFrames);
+  return &result;
+}
+
+std::string ClusterWorker::getStatsString() const {
+  std::ostringstream ss;
+  ss << "clusters: latency " << latencyFrames << " (max " << maxLatencyFrames << ") frames, "
+     << completedCount << "/" << submittedCount << " jobs done, "
+     << skippedCount << " skipped while busy, " << droppedCount << " dropped";
+  return ss.str();
+}
+
+void ClusterWorker::run() {
+  std::unique_lock<std::mutex> lock(jobMutex);
+  for (;;) {
+    jobAvailable.wait(lock, [this] { return stopping || jobPending; });
+    if (stopping) return;
+    std::swap(pendingJob, runningJob); // swap keeps both snapshot buffers allocated
+    jobPending = false;
+    running = true;
+    lock.unlock();
+    cluster(runningJob, results[writeIndex]);
+    publish();
+    lock.lock();
+    running = false;
+  }
+}
+
+void ClusterWorker::cluster(const Job& job, Result& result) {
+  if (job.coreset) {
+    result.stats = coresetClusterer.cluster(job.notes, job.params, job.coresetCells, std::get<0>(result.clusterResults), std::get<1>(result.clusterResults));
+  } else {
+    result.stats = dkm::kmeans_lloyd_parallel(job.notes, job.params, threadPool, workspace, std::get<0>(result.clusterResults), std::get<1>(result.clusterResults));
+  }
+  result.firstSeq = job.firstSeq;
+  result.frame = job.frame;
+}
+
+void ClusterWorker::publish() {
+  uint8_t previous = sharedIndex.exchange(writeIndex | freshBit, std::memory_order_acq_rel);
+  writeIndex = previous & ~freshBit;
+  if (previous & freshBit) droppedCount++;
+  completedCount++;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "dkm_parallel.hpp"
+#include "dkm_coreset.hpp"
+#include "NoteHistory.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using DkmClusterResults = std::tuple<std::vector<std::array<float, 2>>, std::vector<uint32_t>>; // (x,y),id
+
+std::string toString(const dkm::clustering_stats& stats);
+
+// Clusters a weighted grid summary of the notes rather than the notes themselves,
+// so the cost is bounded by the grid not the history
+class NoteCoresetClusterer {
+public:
+  template <typename Points, typename Labels>
+  dkm::clustering_stats cluster(const Points& notes, const dkm::clustering_parameters<float>& params, uint32_t cellsPerSide, std::vector<std::array<float, 2>>& means, Labels& labels) {
+    buildCoreset(notes, cellsPerSide);
+    dkm::clustering_stats stats = clusterCoreset(params, means);
+    coreset.expand_labels(coresetLabels, labels);
+    return stats;
+  }
+
+private:
+  template <typename Points>
+  void buildCoreset(const Points& notes, uint32_t cellsPerSide) {
+    if (coreset.cells_per_dimension() != cellsPerSide) {
+      coreset = dkm::grid_coreset<float, 2> { cellsPerSide };
+    }
+    coreset.build(notes);
+  }
+  dkm::clustering_stats clusterCoreset(const dkm::clustering_parameters<float>& params, std::vector<std::array<float, 2>>& means);
+
+  dkm::grid_coreset<float, 2> coreset { 64 };
+  dkm::kmeans_workspace<float, 2> workspace;
+  std::vector<uint32_t> coresetLabels;
+};
+
+// Runs k-means on a worker thread against snapshots of the note window.
+// The render thread offers a snapshot every frame, but it is only taken while the worker is idle, so the
+// window is copied once per job rather than once per frame. Finished results are published through a
+// lock-free triple buffer, so the render thread never waits on a running job and the worker never waits
+// on the render thread.
+class ClusterWorker {
+public:
+  struct Result {
+    DkmClusterResults clusterResults; // labels are index-aligned with the snapshot
+    dkm::clustering_stats stats;
+    uint64_t firstSeq; // sequence number of the first note in the snapshot
+    uint64_t frame; // when the snapshot was submitted
+  };
+
+  explicit ClusterWorker(dkm::thread_pool& threadPool);
+  ~ClusterWorker();
+
+  // Copy the notes and start clustering them, unless the worker is still busy with the last job; returns whether it started
+  bool submit(const NoteHistory::PointView<2>& notes, uint64_t firstSeq, const dkm::clustering_parameters<float>& params, bool coreset, uint32_t coresetCells, uint64_t frame);
+  // The newest finished result that hasn't been fetched yet, or nullptr; valid until the next call
+  const Result* fetchResult(uint64_t frame);
+
+  uint64_t getSubmittedCount() const { return submittedCount; }
+  uint64_t getSkippedCount() const { return skippedCount; } // snapshots not taken because the worker was busy
+  uint64_t getCompletedCount() const { return completedCount; }
+  uint64_t getDroppedCount() const { return droppedCount; } // results replaced before they were fetched
+  uint64_t getLatencyFrames() const { return latencyFrames; } // age of the last fetched result
+  uint64_t getMaxLatencyFrames() const { return maxLatencyFrames; }
+  std::string getStatsString() const;
+
+private:
+  struct Job {
+    std::vector<std::array<float, 2>> notes;
+    uint64_t firstSeq { 0 };
+    dkm::clustering_parameters<float> params { 0 };
+    bool coreset { false };
+    uint32_t coresetCells { 0 };
+    uint64_t frame { 0 };
+  };
+
+  void run();
+  void cluster(const Job& job, Result& result);
+  void publish();
+
+  dkm::thread_pool& threadPool;
+  NoteCoresetClusterer coresetClusterer;
+  dkm::parallel_kmeans_workspace<float, 2> workspace; // reused by every job that isn't on a coreset
+
+  std::mutex jobMutex; // held only to hand over jobs, never while clustering
+  std::condition_variable jobAvailable;
+  Job pendingJob;
+  Job runningJob;
+  bool jobPending { false };
+  bool running { false }; // clustering runningJob
+  bool stopping { false };
+
+  // The worker fills results[writeIndex] and the render thread reads results[readIndex];
+  // sharedIndex holds the third slot, marked with freshBit when it holds an unfetched result.
+  static constexpr uint8_t freshBit = 4;
+  std::array<Result, 3> results;
+  uint8_t writeIndex { 0 };
+  uint8_t readIndex { 1 };
+  std::atomic<uint8_t> sharedIndex { 2 };
+
+  std::atomic<uint64_t> submittedCount { 0 };
+  std::atomic<uint64_t> skippedCount { 0 };
+  std::atomic<uint64_t> completedCount { 0 };
+  std::atomic<uint64_t> droppedCount { 0 };
+  uint64_t latencyFrames { 0 };
+  uint64_t maxLatencyFrames { 0 };
+
+  std::thread thread; // last, so everything it uses exists before it starts
+};
@@ -16,4 +16,17 @@ namespace Constants {
   static const size_t SOM_HEIGHT = 256;
 
   static const int CIRCLE_RESOLUTION = 64;
+
+  // Bytes per channel of the canvas layers: 4 (RGBA32F), 2 (RGBA16F) or 1 (RGBA8, with dithered fades).
+  // If FBO_MEMORY_DOWNGRADE, layers are moved down at startup until every fbo fits FBO_MEMORY_BUDGET_MB,
+  // otherwise the app stops with a report of what it needed.
+  static const int FOREGROUND_CHANNEL_BYTES = 4;
+  static const int CRYSTAL_CHANNEL_BYTES = 4;
+  static const int DIVISIONS_CHANNEL_BYTES = 1;
+  static const size_t FBO_MEMORY_BUDGET_MB = 8192;
+  static const bool FBO_MEMORY_DOWNGRADE = true;
+
+  // The crystal layer only allocates tiles where there are crystals, up to this many
+  static const int CRYSTAL_TILE_SIZE = 512;
+  static const size_t CRYSTAL_MAX_TILES = 96;
 };
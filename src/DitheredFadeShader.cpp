@@ -0,0 +1,44 @@
+#include "DitheredFadeShader.h"
+
+void DitheredFadeShader::load() {
+  // GLSL 1.20 to suit the app's GL 2.1 context
+  shader.setupShaderFromSource(GL_VERTEX_SHADER, R"(
+    #version 120
+    varying vec2 texCoord;
+    void main() {
+      texCoord = gl_MultiTexCoord0.xy;
+      gl_Position = ftransform();
+    }
+  )");
+  shader.setupShaderFromSource(GL_FRAGMENT_SHADER, R"(
+    #version 120
+    uniform sampler2D tex0;
+    uniform vec4 multiplyBy;
+    uniform float seed;
+    varying vec2 texCoord;
+    float noise(vec2 p) {
+      return fract(sin(dot(p, vec2(12.9898, 78.233)) + seed) * 43758.5453);
+    }
+    void main() {
+      vec2 p = gl_FragCoord.xy;
+      vec4 dither = vec4(noise(p), noise(p + 17.0), noise(p + 31.0), noise(p + 47.0)) - 0.5;
+      gl_FragColor = texture2D(tex0, texCoord) * multiplyBy + dither / 255.0;
+    }
+  )");
+  shader.linkProgram();
+}
+
+void DitheredFadeShader::render(PingPongFbo& fbo, glm::vec4 multiplyBy) {
+  fbo.getTarget().begin();
+  ofPushStyle();
+  ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+  ofSetColor(255);
+  shader.begin();
+  shader.setUniform4f("multiplyBy", multiplyBy);
+  shader.setUniform1f("seed", ofGetFrameNum() % 1000);
+  fbo.getSource().draw(0.0, 0.0);
+  shader.end();
+  ofPopStyle();
+  fbo.getTarget().end();
+  fbo.swap();
+}
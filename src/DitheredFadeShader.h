@@ -0,0 +1,16 @@
+#pragma once
+
+#include "ofMain.h"
+#include "PingPongFbo.h"
+
+// Multiplies a layer by a colour like MultiplyColorShader, with up to half an 8-bit step of noise added
+// before the result is stored. Without it, an 8-bit layer stops fading once x * fade rounds back to x,
+// leaving a residue; with it, each pixel rounds down often enough that the fade continues on average.
+class DitheredFadeShader {
+public:
+  void load();
+  void render(PingPongFbo& fbo, glm::vec4 multiplyBy);
+
+private:
+  ofShader shader;
+};
@@ -0,0 +1,100 @@
+#include "FboBudget.h"
+#include <algorithm>
+#include <sstream>
+
+namespace {
+
+std::string megabytes(size_t bytes) {
+  return ofToString(bytes / (1024.0 * 1024.0), 0) + " MB";
+}
+
+GLint lowerPrecision(GLint internalFormat) {
+  switch (internalFormat) {
+    case GL_RGBA32F: return GL_RGBA16F;
+    case GL_RGBA16F: return GL_RGBA8;
+    default: return internalFormat;
+  }
+}
+
+}
+
+FboBudget::FboBudget(size_t budgetBytes_) :
+budgetBytes(budgetBytes_)
+{}
+
+GLint FboBudget::rgbaFormat(int channelBytes) {
+  if (channelBytes >= 4) return GL_RGBA32F;
+  if (channelBytes >= 2) return GL_RGBA16F;
+  return GL_RGBA8;
+}
+
+size_t FboBudget::bytesPerPixel(GLint internalFormat) {
+  switch (internalFormat) {
+    case GL_RGBA32F: case GL_RGB32F: return 16;
+    case GL_RGBA16F: case GL_RGB16F: case GL_RGBA16: return 8;
+    case GL_R32F: case GL_RG16F: return 4;
+    case GL_R16F: case GL_RG8: return 2;
+    case GL_R8: case GL_LUMINANCE: return 1;
+    default: return 4; // RGBA8, and RGB8 padded
+  }
+}
+
+std::string FboBudget::formatName(GLint internalFormat) {
+  switch (internalFormat) {
+    case GL_RGBA32F: return "RGBA32F";
+    case GL_RGB32F: return "RGB32F";
+    case GL_RGBA16F: return "RGBA16F";
+    case GL_RGB16F: return "RGB16F";
+    case GL_RGBA: case GL_RGBA8: return "RGBA8";
+    case GL_RGB: case GL_RGB8: return "RGB8";
+    case GL_R8: return "R8";
+    default: return ofToString(internalFormat);
+  }
+}
+
+void FboBudget::add(const std::string& name, int width, int height, GLint internalFormat, int buffers, bool downgradable) {
+  layers.push_back({ name, width, height, internalFormat, internalFormat, buffers, downgradable });
+}
+
+bool FboBudget::fit(bool downgrade) {
+  while (downgrade && getTotalBytes() > budgetBytes) {
+    // the largest layer that can still go down a step
+    auto largest = layers.end();
+    for (auto it = layers.begin(); it != layers.end(); ++it) {
+      if (!it->downgradable || lowerPrecision(it->internalFormat) == it->internalFormat) continue;
+      if (largest == layers.end() || it->bytes() > largest->bytes()) largest = it;
+    }
+    if (largest == layers.end()) break;
+    largest->internalFormat = lowerPrecision(largest->internalFormat);
+  }
+  return getTotalBytes() <= budgetBytes;
+}
+
+GLint FboBudget::getFormat(const std::string& name) const {
+  return layer(name).internalFormat;
+}
+
+size_t FboBudget::getTotalBytes() const {
+  size_t total = 0;
+  for (const auto& layer : layers) total += layer.bytes();
+  return total;
+}
+
+std::string FboBudget::getReport() const {
+  std::ostringstream ss;
+  ss << "fbo memory:";
+  for (const auto& layer : layers) {
+    ss << "\n  " << layer.name << ": " << layer.width << "x" << layer.height << " " << formatName(layer.internalFormat);
+    if (layer.internalFormat != layer.requestedFormat) ss << " (downgraded from " << formatName(layer.requestedFormat) << ")";
+    if (layer.buffers > 1) ss << " x" << layer.buffers;
+    ss << ", " << megabytes(layer.bytes());
+  }
+  ss << "\n  total " << megabytes(getTotalBytes()) << " of a " << megabytes(budgetBytes) << " budget";
+  return ss.str();
+}
+
+const FboBudget::Layer& FboBudget::layer(const std::string& name) const {
+  auto it = std::find_if(layers.begin(), layers.end(), [&](const Layer& layer) { return layer.name == name; });
+  assert(it != layers.end());
+  return *it;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ofMain.h"
+#include <string>
+#include <vector>
+
+// Adds up the video memory the app's fbos will take before they're allocated, so a configuration that
+// doesn't fit the budget is caught at startup. If allowed, layers marked as downgradable are moved to
+// lower precision formats (RGBA32F, then RGBA16F, then RGBA8), largest first, until the total fits.
+// Sizes are estimates from the formats, with RGB formats counted as padded to four channels; the fluid
+// simulation's internal buffers aren't visible from here, so only what the app can query is counted.
+class FboBudget {
+public:
+  explicit FboBudget(size_t budgetBytes);
+
+  // The RGBA format with this many bytes per channel (4, 2 or 1)
+  static GLint rgbaFormat(int channelBytes);
+  static size_t bytesPerPixel(GLint internalFormat);
+  static std::string formatName(GLint internalFormat);
+
+  // buffers is 2 for ping-pong layers
+  void add(const std::string& name, int width, int height, GLint internalFormat, int buffers, bool downgradable);
+  // Downgrade if allowed and necessary, and return whether the layers now fit
+  bool fit(bool downgrade);
+
+  GLint getFormat(const std::string& name) const;
+  size_t getTotalBytes() const;
+  std::string getReport() const;
+
+private:
+  struct Layer {
+    std::string name;
+    int width;
+    int height;
+    GLint internalFormat;
+    GLint requestedFormat;
+    int buffers;
+    bool downgradable;
+    size_t bytes() const { return static_cast<size_t>(width) * height * bytesPerPixel(internalFormat) * buffers; }
+  };
+
+  const Layer& layer(const std::string& name) const;
+
+  size_t budgetBytes;
+  std::vector<Layer> layers;
+};
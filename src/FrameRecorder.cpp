@@ -0,0 +1,120 @@
+#include "FrameRecorder.h"
+#include <sstream>
+
+FrameRecorder::FrameRecorder(ofxFFmpegRecorder& recorder_) :
+recorder(recorder_),
+thread([this] { run(); })
+{}
+
+FrameRecorder::~FrameRecorder() {
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    stopping = true;
+  }
+  frameQueued.notify_one();
+  thread.join();
+}
+
+void FrameRecorder::setup(int width, int height, float frameRate, size_t queueCapacity_) {
+  fbo.allocate(width, height, GL_RGB);
+  for (auto& pixelBuffer : pixelBuffers) pixelBuffer.allocate(static_cast<size_t>(width) * height * 3, GL_STREAM_READ);
+  pending = {};
+  nextSlot = 0;
+  framePeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(1.0 / frameRate));
+  std::lock_guard<std::mutex> lock(queueMutex);
+  queueCapacity = std::max<size_t>(queueCapacity_, 1);
+}
+
+void FrameRecorder::resetStats() {
+  frameCount = 0;
+  encodedCount = 0;
+  droppedCount = 0;
+  lateCount = 0;
+}
+
+void FrameRecorder::addFrame(const ofFbo& source) {
+  fbo.begin();
+  {
+    ofPushStyle();
+    ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+    ofSetColor(255);
+    source.draw(0.0, 0.0, fbo.getWidth(), fbo.getHeight());
+    ofPopStyle();
+  }
+  fbo.end();
+
+  // the slot was last filled ringSize frames ago, so its transfer will have finished
+  size_t slot = nextSlot;
+  if (pending[slot]) readBack(slot, false);
+  fbo.getTexture().copyTo(pixelBuffers[slot]);
+  pending[slot] = true;
+  nextSlot = (slot + 1) % ringSize;
+  frameCount++;
+}
+
+void FrameRecorder::flush() {
+  for (size_t i = 0; i < ringSize; i++) {
+    size_t slot = (nextSlot + i) % ringSize; // oldest first
+    if (pending[slot]) readBack(slot, true);
+  }
+  std::unique_lock<std::mutex> lock(queueMutex);
+  frameEncoded.wait(lock, [this] { return queue.empty() && !encoding; });
+}
+
+std::string FrameRecorder::getStatsString() const {
+  std::ostringstream ss;
+  ss << "recording: " << encodedCount << "/" << frameCount << " frames encoded, "
+     << droppedCount << " dropped, " << lateCount << " late";
+  return ss.str();
+}
+
+void FrameRecorder::readBack(size_t slot, bool wait) {
+  Frame frame;
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (!freePixels.empty()) {
+      frame.pixels = std::move(freePixels.back());
+      freePixels.pop_back();
+    }
+  }
+  const unsigned char* data = pixelBuffers[slot].map<unsigned char>(GL_READ_ONLY);
+  if (data) frame.pixels.setFromPixels(data, fbo.getWidth(), fbo.getHeight(), OF_PIXELS_RGB);
+  pixelBuffers[slot].unmap();
+  pending[slot] = false;
+  if (!data) return;
+
+  {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    if (wait) {
+      frameEncoded.wait(lock, [this] { return queue.size() < queueCapacity; });
+    } else if (queue.size() >= queueCapacity) {
+      droppedCount++;
+      freePixels.push_back(std::move(frame.pixels));
+      return;
+    }
+    frame.queuedTime = std::chrono::steady_clock::now();
+    queue.push_back(std::move(frame));
+  }
+  frameQueued.notify_one();
+}
+
+void FrameRecorder::run() {
+  std::unique_lock<std::mutex> lock(queueMutex);
+  for (;;) {
+    frameQueued.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (queue.empty()) return; // stopping, with nothing left to encode
+    Frame frame = std::move(queue.front());
+    queue.pop_front();
+    encoding = true;
+    lock.unlock();
+
+    if (std::chrono::steady_clock::now() - frame.queuedTime > framePeriod) lateCount++;
+    recorder.addFrame(frame.pixels);
+    encodedCount++;
+
+    lock.lock();
+    freePixels.push_back(std::move(frame.pixels));
+    encoding = false;
+    frameEncoded.notify_all();
+  }
+}
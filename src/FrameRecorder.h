@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxFFmpegRecorder.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Feeds an ofxFFmpegRecorder without stalling the render thread.
+// Each frame is downscaled on the GPU into a recording-sized fbo and copied into the next of a ring of
+// pixel buffers, which is only mapped when the ring comes back round to it, long after the transfer has
+// finished. The pixels then go through a bounded queue to an encoder thread that makes the (blocking)
+// addFrame calls; when the encoder falls behind and the queue is full, frames are dropped rather than
+// holding up the render thread.
+class FrameRecorder {
+public:
+  static constexpr size_t ringSize = 3;
+
+  explicit FrameRecorder(ofxFFmpegRecorder& recorder);
+  ~FrameRecorder();
+
+  void setup(int width, int height, float frameRate, size_t queueCapacity);
+  void resetStats();
+
+  // Record a frame of source, scaled to fit
+  void addFrame(const ofFbo& source);
+  // Hand over the frames still being read back and wait for the encoder to finish with them, before the recorder stops
+  void flush();
+
+  uint64_t getFrameCount() const { return frameCount; }
+  uint64_t getEncodedCount() const { return encodedCount; }
+  uint64_t getDroppedCount() const { return droppedCount; } // read back when the queue was full
+  uint64_t getLateCount() const { return lateCount; } // waited more than a frame in the queue before encoding
+  std::string getStatsString() const;
+
+private:
+  struct Frame {
+    ofPixels pixels;
+    std::chrono::steady_clock::time_point queuedTime;
+  };
+
+  void readBack(size_t slot, bool wait);
+  void run();
+
+  ofxFFmpegRecorder& recorder;
+
+  ofFbo fbo;
+  std::array<ofBufferObject, ringSize> pixelBuffers;
+  std::array<bool, ringSize> pending {};
+  size_t nextSlot { 0 };
+  std::chrono::steady_clock::duration framePeriod {};
+  size_t queueCapacity { 1 };
+
+  std::mutex queueMutex; // held only to hand over frames, never while encoding
+  std::condition_variable frameQueued;
+  std::condition_variable frameEncoded;
+  std::deque<Frame> queue;
+  std::vector<ofPixels> freePixels; // encoded frames' pixels, to reuse
+  bool encoding { false };
+  bool stopping { false };
+
+  std::atomic<uint64_t> frameCount { 0 };
+  std::atomic<uint64_t> encodedCount { 0 };
+  std::atomic<uint64_t> droppedCount { 0 };
+  std::atomic<uint64_t> lateCount { 0 };
+
+  std::thread thread; // last, so everything it uses exists before it starts
+};
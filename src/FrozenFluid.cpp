@@ -0,0 +1,19 @@
+#include "FrozenFluid.h"
+
+void FrozenFluid::allocate(int width, int height) {
+  fbo.allocate(width, height, GL_RGBA);
+  captured = false;
+}
+
+void FrozenFluid::capture(const ofFbo& source) {
+  fbo.begin();
+  {
+    ofPushStyle();
+    ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+    ofSetColor(255);
+    source.draw(0.0, 0.0, fbo.getWidth(), fbo.getHeight());
+    ofPopStyle();
+  }
+  fbo.end();
+  captured = true;
+}
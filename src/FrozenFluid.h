@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ofMain.h"
+
+// A still of the fluid values, for the crystals to show through their masks. Capturing draws the
+// fluid into a persistent fbo on the GPU, so nothing waits for it.
+class FrozenFluid {
+public:
+  void allocate(int width, int height);
+  void capture(const ofFbo& source);
+
+  bool isAllocated() const { return captured; } // there is a capture to show
+  ofTexture& getTexture() { return fbo.getTexture(); }
+
+private:
+  ofFbo fbo;
+  bool captured { false };
+};
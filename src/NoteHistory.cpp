@@ -0,0 +1,27 @@
+#include "NoteHistory.h"
+
+constexpr size_t NoteHistory::featureCount;
+constexpr uint32_t NoteHistory::noLabel;
+
+void NoteHistory::setup(size_t capacity) {
+  assert(capacity > 0);
+  for (auto& column : columns) column.assign(capacity, 0.0);
+  labels.assign(capacity, noLabel);
+  firstSeq = endSeq;
+}
+
+uint64_t NoteHistory::append(float s, float t, float u, float v) {
+  if (size() == capacity()) evictOldest();
+  size_t i = slot(endSeq);
+  columns[0][i] = s;
+  columns[1][i] = t;
+  columns[2][i] = u;
+  columns[3][i] = v;
+  labels[i] = noLabel;
+  return endSeq++;
+}
+
+void NoteHistory::evictOldest() {
+  assert(!empty());
+  firstSeq++;
+}
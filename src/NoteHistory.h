@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Fixed-capacity ring of the most recent notes. Every note gets a sequence number, counting up from 0
+// and never reused, so a note can be addressed by its sequence number for as long as it stays in the
+// ring. The features are kept in separate columns, so any of them can be viewed as dkm points without
+// repacking, along with a column of cluster labels.
+class NoteHistory {
+public:
+  enum class Feature { s, t, u, v }; // pitch, RMS, spectral kurtosis, spectral centroid
+  static constexpr size_t featureCount = 4;
+  static constexpr uint32_t noLabel = std::numeric_limits<uint32_t>::max();
+
+  void setup(size_t capacity);
+
+  // Add a note, evicting the oldest if the ring is full, and return its sequence number
+  uint64_t append(float s, float t, float u, float v);
+  void evictOldest();
+
+  size_t size() const { return endSeq - firstSeq; }
+  size_t capacity() const { return labels.size(); }
+  bool empty() const { return firstSeq == endSeq; }
+  uint64_t getFirstSeq() const { return firstSeq; } // oldest note
+  uint64_t getEndSeq() const { return endSeq; } // one past the newest note
+  bool contains(uint64_t seq) const { return seq >= firstSeq && seq < endSeq; }
+
+  float get(Feature feature, uint64_t seq) const { assert(contains(seq)); return columns[static_cast<size_t>(feature)][slot(seq)]; }
+  uint32_t& label(uint64_t seq) { assert(contains(seq)); return labels[slot(seq)]; }
+  uint32_t label(uint64_t seq) const { assert(contains(seq)); return labels[slot(seq)]; }
+
+  // The notes as N-dimensional points of the chosen features, indexed from 0 (the oldest note)
+  template <size_t N>
+  class PointView {
+  public:
+    PointView(const NoteHistory& history_, const std::array<Feature, N>& features_) : history(history_), features(features_) {}
+    size_t size() const { return history.size(); }
+    std::array<float, N> operator[](size_t i) const {
+      size_t slot = history.slot(history.firstSeq + i);
+      std::array<float, N> point;
+      for (size_t j = 0; j < N; j++) point[j] = history.columns[static_cast<size_t>(features[j])][slot];
+      return point;
+    }
+  private:
+    const NoteHistory& history;
+    std::array<Feature, N> features;
+  };
+
+  template <size_t N>
+  PointView<N> points(const std::array<Feature, N>& features) const { return PointView<N>(*this, features); }
+  std::array<float, 2> xy(uint64_t seq) const { return { get(Feature::s, seq), get(Feature::t, seq) }; }
+  PointView<2> xys() const { return points<2>({ Feature::s, Feature::t }); }
+
+  // The labels, indexed like a PointView, as a container for the dkm functions that fill in labels
+  class LabelView {
+  public:
+    explicit LabelView(NoteHistory& history_) : history(history_) {}
+    size_t size() const { return history.size(); }
+    uint32_t& operator[](size_t i) { return history.labels[history.slot(history.firstSeq + i)]; }
+    uint32_t operator[](size_t i) const { return history.labels[history.slot(history.firstSeq + i)]; }
+    void resize(size_t size) { assert(size == history.size()); } // the window can't change size from here
+    template <typename It>
+    void assign(It first, It last) {
+      resize(last - first);
+      for (size_t i = 0; first != last; ++first, ++i) (*this)[i] = *first;
+    }
+  private:
+    NoteHistory& history;
+  };
+
+  LabelView labelView() { return LabelView(*this); }
+
+private:
+  size_t slot(uint64_t seq) const { return seq % labels.size(); }
+
+  std::array<std::vector<float>, featureCount> columns;
+  std::vector<uint32_t> labels;
+  uint64_t firstSeq { 0 };
+  uint64_t endSeq { 0 };
+};
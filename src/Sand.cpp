@@ -0,0 +1,92 @@
+#include "Sand.h"
+#include <algorithm>
+
+namespace {
+
+// Grains generated per task, so the tasks stay even however the grains are spread over the segments
+constexpr size_t grainsPerTask = 1024;
+
+// SplitMix64's mixing function: a good hash of a counter, which makes a stateless generator
+uint64_t splitMix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// The nth number in [0, 1) of a stream
+float uniform(uint64_t stream, uint64_t n) {
+  return (splitMix64(stream + n * 0x9e3779b97f4a7c15) >> 40) * 0x1.0p-24f;
+}
+
+}
+
+Sand::Sand(dkm::thread_pool& threadPool_) :
+threadPool(threadPool_)
+{
+  for (int i = 0; i <= grainSides; i++) {
+    float angle = glm::two_pi<float>() * i / grainSides;
+    unitCircle[i] = { std::cos(angle), std::sin(angle) };
+  }
+}
+
+void Sand::add(uint64_t key, glm::vec2 from, glm::vec2 to, float density, float maxRadius, const ofFloatColor& color) {
+  uint32_t grains = glm::distance(from, to) * density;
+  if (grains == 0) return;
+  segments.push_back({ key, from, to, maxRadius, color, grainCount, grains });
+  grainCount += grains;
+}
+
+void Sand::draw() {
+  // batches of whole segments, so a segment's grains are generated together
+  size_t firstSegment = 0;
+  while (firstSegment < segments.size()) {
+    size_t endSegment = firstSegment + 1;
+    size_t batchEnd = segments[firstSegment].firstGrain + maxGrainsPerBatch;
+    while (endSegment < segments.size() && segments[endSegment].firstGrain + segments[endSegment].grainCount <= batchEnd) endSegment++;
+
+    generate(firstSegment, endSegment);
+    vbo.setVertexData(vertices.data(), vertices.size(), GL_STREAM_DRAW);
+    vbo.setColorData(colors.data(), colors.size(), GL_STREAM_DRAW);
+    vbo.draw(GL_TRIANGLES, 0, vertices.size());
+    firstSegment = endSegment;
+  }
+  segments.clear();
+  grainCount = 0;
+}
+
+void Sand::generate(size_t firstSegment, size_t endSegment) {
+  size_t batchFirstGrain = segments[firstSegment].firstGrain;
+  size_t batchGrains = segments[endSegment - 1].firstGrain + segments[endSegment - 1].grainCount - batchFirstGrain;
+  constexpr size_t verticesPerGrain = grainSides * 3;
+  vertices.resize(batchGrains * verticesPerGrain);
+  colors.resize(batchGrains * verticesPerGrain);
+
+  threadPool.parallel_for((batchGrains + grainsPerTask - 1) / grainsPerTask, [&](size_t task) {
+    size_t first = batchFirstGrain + task * grainsPerTask;
+    size_t end = std::min(first + grainsPerTask, batchFirstGrain + batchGrains);
+    // the segment holding the first grain of the task
+    auto segment = std::upper_bound(segments.begin() + firstSegment, segments.begin() + endSegment, first,
+                                    [](size_t grain, const Segment& s) { return grain < s.firstGrain; }) - 1;
+    uint64_t segmentStream = splitMix64(seed ^ splitMix64(segment->key));
+    for (size_t grain = first; grain < end; grain++) {
+      if (grain >= segment->firstGrain + segment->grainCount) {
+        ++segment;
+        segmentStream = splitMix64(seed ^ splitMix64(segment->key));
+      }
+      uint64_t stream = splitMix64(segmentStream + grain - segment->firstGrain);
+      float r = segment->maxRadius;
+      glm::vec2 centre = glm::mix(segment->from, segment->to, uniform(stream, 0));
+      centre += glm::vec2 { uniform(stream, 1) * r * 2.0f - r, uniform(stream, 2) * r * 2.0f - r };
+      float radius = 1.0f + uniform(stream, 3) * r;
+
+      size_t v = (grain - batchFirstGrain) * verticesPerGrain;
+      for (int side = 0; side < grainSides; side++) {
+        vertices[v + side * 3] = centre;
+        vertices[v + side * 3 + 1] = centre + unitCircle[side] * radius;
+        vertices[v + side * 3 + 2] = centre + unitCircle[side + 1] * radius;
+      }
+      std::fill(colors.begin() + v, colors.begin() + v + verticesPerGrain, segment->color);
+    }
+  });
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "dkm_parallel.hpp"
+#include "ofMain.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Grains of sand scattered along line segments, each a small filled circle. Each grain's position and
+// size come from a counter-based generator keyed on (seed, segment key, grain number), so a segment always
+// gets the same grains however the work is split. The queued segments' grains are generated in parallel
+// into one vertex buffer and drawn with one call per batch of maxGrainsPerBatch.
+class Sand {
+public:
+  static constexpr size_t maxGrainsPerBatch = 32768;
+  static constexpr int grainSides = 8;
+
+  explicit Sand(dkm::thread_pool& threadPool);
+
+  void setSeed(uint64_t seed_) { seed = seed_; }
+  // Queue the grains between from and to for the next draw; density is grains per unit length,
+  // each grain scattered up to maxRadius off the line and 1 to 1 + maxRadius across
+  void add(uint64_t key, glm::vec2 from, glm::vec2 to, float density, float maxRadius, const ofFloatColor& color);
+  // Draw the queued grains in the current style's blend mode, and empty the queue
+  void draw();
+
+  size_t getGrainCount() const { return grainCount; } // queued since the last draw
+
+private:
+  struct Segment {
+    uint64_t key;
+    glm::vec2 from;
+    glm::vec2 to;
+    float maxRadius;
+    ofFloatColor color;
+    size_t firstGrain; // of all the queued grains
+    uint32_t grainCount;
+  };
+
+  void generate(size_t firstSegment, size_t endSegment);
+
+  dkm::thread_pool& threadPool;
+  uint64_t seed { 0 };
+  std::vector<Segment> segments;
+  size_t grainCount { 0 };
+
+  std::array<glm::vec2, grainSides + 1> unitCircle;
+  std::vector<glm::vec2> vertices; // grainSides triangles per grain
+  std::vector<ofFloatColor> colors;
+  ofVbo vbo;
+};
@@ -0,0 +1,372 @@
+#include "SelfOrganizingMap.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <sstream>
+
+#if !defined(SOM_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#include <emmintrin.h>
+#define SOM_SIMD_SSE2
+#elif !defined(SOM_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+#include <arm_neon.h>
+#define SOM_SIMD_NEON
+#endif
+
+namespace {
+
+// Bands are at least this many nodes, so handing one to a thread costs little next to working on it
+constexpr size_t minBandSize = 8192;
+
+// Split rows into bands for the thread pool: a few per thread, to even out the load
+int rowsPerBand(int rows, int width, size_t threads) {
+  int minRows = std::max<int>(1, minBandSize / std::max(width, 1));
+  int balancedRows = std::max<int>(1, rows / static_cast<int>(threads * 4));
+  return std::max(minRows, balancedRows);
+}
+
+// Pyramid levels stop once they are this small, and the coarsest is searched in full
+constexpr int coarsestLevelSize = 16;
+
+float distance2At(const float* planes, size_t stride, int numFeatures, size_t i, const float* instance) {
+  float distance2 = 0.0;
+  for (int f = 0; f < numFeatures; f++) {
+    float d = planes[f * stride + i] - instance[f];
+    distance2 += d * d;
+  }
+  return distance2;
+}
+
+}
+
+std::string toString(const SelfOrganizingMap::SearchStats& stats) {
+  std::ostringstream ss;
+  ss << "som: " << stats.approximateSearches << " approximate searches, " << stats.exactSearches << " checked, "
+     << stats.misses << " missed";
+  if (stats.exactSearches > 0) {
+    ss << ", excess distance mean " << stats.totalExcessDistance / stats.exactSearches << " max " << stats.maxExcessDistance;
+  }
+  return ss.str();
+}
+
+SelfOrganizingMap::SelfOrganizingMap(dkm::thread_pool& threadPool_) :
+threadPool(threadPool_)
+{}
+
+void SelfOrganizingMap::setFeaturesRange(int numFeatures_, const double minInstance_[], const double maxInstance_[]) {
+  assert(numFeatures_ > 0 && numFeatures_ <= maxFeatures);
+  numFeatures = numFeatures_;
+  for (int f = 0; f < numFeatures; f++) {
+    minInstance[f] = minInstance_[f];
+    maxInstance[f] = maxInstance_[f];
+  }
+}
+
+void SelfOrganizingMap::setMapSize(int width_, int height_) {
+  width = width_;
+  height = height_;
+}
+
+void SelfOrganizingMap::setInitialLearningRate(double initialLearningRate_) {
+  initialLearningRate = initialLearningRate_;
+}
+
+void SelfOrganizingMap::setNumIterations(int numIterations_) {
+  numIterations = numIterations_;
+}
+
+void SelfOrganizingMap::setRandomSeed(uint32_t seed_) {
+  seed = seed_;
+}
+
+void SelfOrganizingMap::setup() {
+  assert(numFeatures > 0 && width > 0 && height > 0);
+  weights.resize(numFeatures * planeSize());
+  std::mt19937 rng(seed);
+  for (int f = 0; f < numFeatures; f++) {
+    std::uniform_real_distribution<float> distribution(minInstance[f], maxInstance[f]);
+    float* plane = weights.data() + f * planeSize();
+    for (size_t i = 0; i < planeSize(); i++) plane[i] = distribution(rng);
+  }
+  iteration = 0;
+  mapRadius = std::max(width, height) / 2.0;
+  timeConstant = numIterations / std::log(std::max(mapRadius, 2.0));
+  previousBestMatchingUnit = 0;
+  if (approximateSearch) buildPyramid();
+}
+
+void SelfOrganizingMap::setApproximateSearch(bool approximate, float exactFallbackRate_) {
+  exactFallbackRate = exactFallbackRate_;
+  if (approximate == approximateSearch) return;
+  approximateSearch = approximate;
+  exactFallbackCredit = 0.0;
+  if (approximateSearch) {
+    if (!weights.empty()) buildPyramid(); // otherwise setup() will
+  } else {
+    pyramid.clear();
+  }
+}
+
+void SelfOrganizingMap::updateMap(const double instance_[]) {
+  std::array<float, maxFeatures> instance;
+  for (int f = 0; f < numFeatures; f++) instance[f] = instance_[f];
+
+  uint32_t bmu = findBestMatchingUnit(instance.data());
+  double t = std::min<double>(iteration, numIterations);
+  float radius = mapRadius * std::exp(-t / timeConstant);
+  float learningRate = initialLearningRate * std::exp(-t / numIterations);
+  updateNeighbourhood(instance.data(), bmu % width, bmu / width, radius, learningRate);
+  if (approximateSearch) updatePyramid(lastUpdateRegion);
+  iteration++;
+}
+
+SelfOrganizingMap::Node SelfOrganizingMap::getMapAt(int x, int y) const {
+  size_t i = static_cast<size_t>(std::clamp(y, 0, height - 1)) * width + std::clamp(x, 0, width - 1);
+  Node node {};
+  for (int f = 0; f < numFeatures; f++) node[f] = weights[f * planeSize() + i];
+  return node;
+}
+
+uint32_t SelfOrganizingMap::findBestMatchingUnit(const float* instance) {
+  if (!approximateSearch) return findBestMatchingUnitExact(instance);
+
+  uint32_t bmu = findBestMatchingUnitApproximate(instance);
+  searchStats.approximateSearches++;
+  exactFallbackCredit += exactFallbackRate;
+  if (exactFallbackCredit >= 1.0) {
+    exactFallbackCredit -= 1.0;
+    uint32_t exactBmu = findBestMatchingUnitExact(instance);
+    searchStats.exactSearches++;
+    if (exactBmu != bmu) {
+      searchStats.misses++;
+      float excess = std::sqrt(distance2At(weights.data(), planeSize(), numFeatures, bmu, instance))
+                   - std::sqrt(distance2At(weights.data(), planeSize(), numFeatures, exactBmu, instance));
+      searchStats.totalExcessDistance += excess;
+      searchStats.maxExcessDistance = std::max<double>(searchStats.maxExcessDistance, excess);
+    }
+    bmu = exactBmu;
+  }
+  previousBestMatchingUnit = bmu;
+  return bmu;
+}
+
+uint32_t SelfOrganizingMap::findBestMatchingUnitExact(const float* instance) {
+  int bandRows = rowsPerBand(height, width, threadPool.size());
+  size_t bandCount = (height + bandRows - 1) / bandRows;
+  bandCandidates.resize(bandCount);
+  threadPool.parallel_for(bandCount, [&](size_t band) {
+    size_t first = band * bandRows * width;
+    size_t last = std::min<size_t>(first + static_cast<size_t>(bandRows) * width, planeSize());
+    bandCandidates[band] = findBestMatchingUnit(instance, first, last);
+  });
+  // bands are in index order, so keeping the first of equals matches a single scan
+  Candidate best = bandCandidates[0];
+  for (const auto& candidate : bandCandidates) {
+    if (candidate.distance2 < best.distance2) best = candidate;
+  }
+  return best.index;
+}
+
+// The closest node in [first, last), with the lowest index among equals
+SelfOrganizingMap::Candidate SelfOrganizingMap::findBestMatchingUnit(const float* instance, size_t first, size_t last) const {
+  const float* planes = weights.data();
+  const size_t stride = planeSize();
+  Candidate best { std::numeric_limits<float>::max(), static_cast<uint32_t>(first) };
+  size_t i = first;
+
+#if defined(SOM_SIMD_SSE2)
+  if (last - first >= 4) {
+    __m128 bestDistances = _mm_set1_ps(std::numeric_limits<float>::max());
+    __m128i bestIndices = _mm_set1_epi32(first);
+    __m128i indices = _mm_add_epi32(_mm_set1_epi32(first), _mm_set_epi32(3, 2, 1, 0));
+    const __m128i four = _mm_set1_epi32(4);
+    for (; i + 4 <= last; i += 4) {
+      __m128 distances = _mm_setzero_ps();
+      for (int f = 0; f < numFeatures; f++) {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(planes + f * stride + i), _mm_set1_ps(instance[f]));
+        distances = _mm_add_ps(distances, _mm_mul_ps(d, d));
+      }
+      __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distances, bestDistances));
+      bestDistances = _mm_min_ps(distances, bestDistances);
+      bestIndices = _mm_or_si128(_mm_and_si128(closer, indices), _mm_andnot_si128(closer, bestIndices));
+      indices = _mm_add_epi32(indices, four);
+    }
+    alignas(16) float laneDistances[4];
+    alignas(16) uint32_t laneIndices[4];
+    _mm_store_ps(laneDistances, bestDistances);
+    _mm_store_si128(reinterpret_cast<__m128i*>(laneIndices), bestIndices);
+    for (int lane = 0; lane < 4; lane++) {
+      if (laneDistances[lane] < best.distance2 || (laneDistances[lane] == best.distance2 && laneIndices[lane] < best.index)) {
+        best = { laneDistances[lane], laneIndices[lane] };
+      }
+    }
+  }
+#elif defined(SOM_SIMD_NEON)
+  if (last - first >= 4) {
+    float32x4_t bestDistances = vdupq_n_f32(std::numeric_limits<float>::max());
+    uint32x4_t bestIndices = vdupq_n_u32(first);
+    const uint32_t laneOffsets[4] = { 0, 1, 2, 3 };
+    uint32x4_t indices = vaddq_u32(vdupq_n_u32(first), vld1q_u32(laneOffsets));
+    const uint32x4_t four = vdupq_n_u32(4);
+    for (; i + 4 <= last; i += 4) {
+      float32x4_t distances = vdupq_n_f32(0.0f);
+      for (int f = 0; f < numFeatures; f++) {
+        float32x4_t d = vsubq_f32(vld1q_f32(planes + f * stride + i), vdupq_n_f32(instance[f]));
+        distances = vaddq_f32(distances, vmulq_f32(d, d));
+      }
+      uint32x4_t closer = vcltq_f32(distances, bestDistances);
+      bestDistances = vbslq_f32(closer, distances, bestDistances);
+      bestIndices = vbslq_u32(closer, indices, bestIndices);
+      indices = vaddq_u32(indices, four);
+    }
+    float laneDistances[4];
+    uint32_t laneIndices[4];
+    vst1q_f32(laneDistances, bestDistances);
+    vst1q_u32(laneIndices, bestIndices);
+    for (int lane = 0; lane < 4; lane++) {
+      if (laneDistances[lane] < best.distance2 || (laneDistances[lane] == best.distance2 && laneIndices[lane] < best.index)) {
+        best = { laneDistances[lane], laneIndices[lane] };
+      }
+    }
+  }
+#endif
+
+  for (; i < last; i++) {
+    float distance2 = 0.0;
+    for (int f = 0; f < numFeatures; f++) {
+      float d = planes[f * stride + i] - instance[f];
+      distance2 += d * d;
+    }
+    if (distance2 < best.distance2) best = { distance2, static_cast<uint32_t>(i) };
+  }
+  return best;
+}
+
+uint32_t SelfOrganizingMap::findBestMatchingUnitApproximate(const float* instance) const {
+  if (pyramid.empty()) return findBestMatchingUnit(instance, 0, planeSize()).index;
+
+  // the closest node in a window of a level, or of the map when level is -1
+  Candidate best;
+  int bestX = 0, bestY = 0;
+  auto searchWindow = [&](int level, int firstX, int firstY, int lastX, int lastY) {
+    int levelWidth = level < 0 ? width : pyramid[level].width;
+    int levelHeight = level < 0 ? height : pyramid[level].height;
+    const float* planes = level < 0 ? weights.data() : pyramid[level].weights.data();
+    size_t stride = static_cast<size_t>(levelWidth) * levelHeight;
+    best = { std::numeric_limits<float>::max(), 0 };
+    for (int y = std::max(firstY, 0); y <= std::min(lastY, levelHeight - 1); y++) {
+      for (int x = std::max(firstX, 0); x <= std::min(lastX, levelWidth - 1); x++) {
+        size_t i = static_cast<size_t>(y) * levelWidth + x;
+        float distance2 = distance2At(planes, stride, numFeatures, i, instance);
+        if (distance2 < best.distance2) {
+          best = { distance2, static_cast<uint32_t>(i) };
+          bestX = x;
+          bestY = y;
+        }
+      }
+    }
+  };
+
+  // coarse to fine, searching the children of the best cell and their neighbours at each level
+  int coarsest = static_cast<int>(pyramid.size()) - 1;
+  searchWindow(coarsest, 0, 0, pyramid[coarsest].width - 1, pyramid[coarsest].height - 1);
+  for (int level = coarsest - 1; level >= -1; level--) {
+    searchWindow(level, 2 * bestX - 1, 2 * bestY - 1, 2 * bestX + 2, 2 * bestY + 2);
+  }
+  Candidate pyramidBest = best;
+  int pyramidX = bestX, pyramidY = bestY;
+
+  // around the previous best matching unit
+  int previousX = previousBestMatchingUnit % width, previousY = previousBestMatchingUnit / width;
+  searchWindow(-1, previousX - 2, previousY - 2, previousX + 2, previousY + 2);
+  if (pyramidBest.distance2 < best.distance2) {
+    best = pyramidBest;
+    bestX = pyramidX;
+    bestY = pyramidY;
+  }
+
+  // then downhill until no neighbour is closer
+  for (int step = 0; step < width + height; step++) {
+    float distance2 = best.distance2;
+    searchWindow(-1, bestX - 1, bestY - 1, bestX + 1, bestY + 1);
+    if (!(best.distance2 < distance2)) break;
+  }
+  return best.index;
+}
+
+void SelfOrganizingMap::buildPyramid() {
+  pyramid.clear();
+  int levelWidth = width, levelHeight = height;
+  while (std::max(levelWidth, levelHeight) > coarsestLevelSize) {
+    levelWidth = (levelWidth + 1) / 2;
+    levelHeight = (levelHeight + 1) / 2;
+    pyramid.push_back({ levelWidth, levelHeight, std::vector<float>(numFeatures * static_cast<size_t>(levelWidth) * levelHeight) });
+  }
+  updatePyramid({ 0, 0, width - 1, height - 1 });
+}
+
+void SelfOrganizingMap::updatePyramid(Region region) {
+  const float* below = weights.data();
+  int belowWidth = width, belowHeight = height;
+  for (auto& level : pyramid) {
+    region = { region.firstColumn / 2, region.firstRow / 2, region.lastColumn / 2, region.lastRow / 2 };
+    size_t belowStride = static_cast<size_t>(belowWidth) * belowHeight;
+    size_t stride = static_cast<size_t>(level.width) * level.height;
+    for (int y = region.firstRow; y <= region.lastRow; y++) {
+      int y0 = 2 * y, y1 = std::min(2 * y + 1, belowHeight - 1);
+      for (int x = region.firstColumn; x <= region.lastColumn; x++) {
+        int x0 = 2 * x, x1 = std::min(2 * x + 1, belowWidth - 1);
+        for (int f = 0; f < numFeatures; f++) {
+          const float* plane = below + f * belowStride;
+          level.weights[f * stride + static_cast<size_t>(y) * level.width + x] = 0.25f *
+            (plane[y0 * belowWidth + x0] + plane[y0 * belowWidth + x1] + plane[y1 * belowWidth + x0] + plane[y1 * belowWidth + x1]);
+        }
+      }
+    }
+    below = level.weights.data();
+    belowWidth = level.width;
+    belowHeight = level.height;
+  }
+}
+
+void SelfOrganizingMap::updateNeighbourhood(const float* instance, int bmuX, int bmuY, float radius, float learningRate) {
+  // the falloff exp(-d^2 / (2 radius^2)) is the product of one for dx and one for dy
+  int reach = std::ceil(radius);
+  columnFalloff.resize(2 * reach + 1);
+  for (int dx = -reach; dx <= reach; dx++) {
+    columnFalloff[dx + reach] = std::exp(-dx * dx / (2.0f * radius * radius));
+  }
+
+  int firstRow = std::max(bmuY - reach, 0), lastRow = std::min(bmuY + reach, height - 1);
+  lastUpdateRegion = { std::max(bmuX - reach, 0), firstRow, std::min(bmuX + reach, width - 1), lastRow };
+  int rows = lastRow - firstRow + 1;
+  int bandRows = rowsPerBand(rows, std::min(2 * reach + 1, width), threadPool.size());
+  size_t bandCount = (rows + bandRows - 1) / bandRows;
+  threadPool.parallel_for(bandCount, [&](size_t band) {
+    int bandFirstRow = firstRow + static_cast<int>(band) * bandRows;
+    updateRows(instance, bmuX, bmuY, bandFirstRow, std::min(bandFirstRow + bandRows - 1, lastRow), radius * radius, learningRate);
+  });
+}
+
+void SelfOrganizingMap::updateRows(const float* instance, int bmuX, int bmuY, int firstRow, int lastRow, float radius2, float learningRate) {
+  int reach = (static_cast<int>(columnFalloff.size()) - 1) / 2;
+  for (int y = firstRow; y <= lastRow; y++) {
+    int dy = y - bmuY;
+    // the run of this row inside the circle: dx^2 < radius^2 - dy^2
+    float span2 = radius2 - dy * dy;
+    if (span2 <= 0.0) continue;
+    int halfWidth = std::min<int>(std::sqrt(span2), reach);
+    while (halfWidth * halfWidth >= span2) halfWidth--;
+    int firstColumn = std::max(bmuX - halfWidth, 0), lastColumn = std::min(bmuX + halfWidth, width - 1);
+    float rowRate = learningRate * columnFalloff[dy + reach];
+    const float* falloff = columnFalloff.data() + reach - bmuX;
+    for (int f = 0; f < numFeatures; f++) {
+      float* row = weights.data() + f * planeSize() + static_cast<size_t>(y) * width;
+      float target = instance[f];
+      for (int x = firstColumn; x <= lastColumn; x++) {
+        row[x] += rowRate * falloff[x] * (target - row[x]);
+      }
+    }
+  }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "dkm_parallel.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A self-organising map with the interface of ofxSelfOrganizingMap as used by the app, for maps of
+// a few hundred nodes square updated every note:
+// - each feature is a float plane, so the best matching unit search streams through memory with SIMD
+// - the search and the neighbourhood update are split into bands of rows across a thread pool
+// - the neighbourhood falloff is separable, so it is tabulated per row and column rather than per node
+// The neighbourhood radius shrinks as mapRadius * exp(-t / timeConstant) and the learning rate as
+// initialLearningRate * exp(-t / numIterations), both holding at their final values after numIterations.
+//
+// The best matching unit search can optionally be approximate: it searches a pyramid of 2x2 averages of
+// the map from the coarsest level down, looks around the previous best matching unit as successive
+// instances tend to be close, and then walks downhill on the full map. A fraction of updates fall back
+// to the exact search, which also measures how far the approximate search would have been out.
+class SelfOrganizingMap {
+public:
+  static constexpr int maxFeatures = 4;
+  using Node = std::array<float, maxFeatures>;
+
+  // Inclusive bounds of an area of the map
+  struct Region {
+    int firstColumn, firstRow, lastColumn, lastRow;
+  };
+
+  struct SearchStats {
+    uint64_t approximateSearches;
+    uint64_t exactSearches; // fallbacks from approximate searches, which are compared against them
+    uint64_t misses; // fallbacks where the approximate search picked another node
+    double totalExcessDistance; // how much further from the instance the approximate picks were, over the fallbacks
+    double maxExcessDistance;
+  };
+
+  explicit SelfOrganizingMap(dkm::thread_pool& threadPool);
+
+  void setFeaturesRange(int numFeatures, const double minInstance[], const double maxInstance[]);
+  void setMapSize(int width, int height);
+  void setInitialLearningRate(double initialLearningRate);
+  void setNumIterations(int numIterations);
+  void setRandomSeed(uint32_t seed);
+  // Fill the map with random weights within the features range, and restart the learning schedule
+  void setup();
+
+  // Search the pyramid instead of the whole map, except for exactFallbackRate of the updates
+  void setApproximateSearch(bool approximate, float exactFallbackRate);
+
+  void updateMap(const double instance[]);
+  // The weights of the node at (x, y), clamped to the map
+  Node getMapAt(int x, int y) const;
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  int getNumFeatures() const { return numFeatures; }
+  uint64_t getIteration() const { return iteration; }
+  const float* getPlane(int feature) const { return weights.data() + feature * planeSize(); }
+  Region getLastUpdateRegion() const { return lastUpdateRegion; } // nodes the last updateMap may have changed
+  const SearchStats& getSearchStats() const { return searchStats; }
+  void resetSearchStats() { searchStats = {}; }
+
+private:
+  struct Candidate {
+    float distance2;
+    uint32_t index;
+  };
+
+  // 2x2 averages of the level below, the first level being half the size of the map
+  struct Level {
+    int width, height;
+    std::vector<float> weights; // numFeatures planes
+  };
+
+  size_t planeSize() const { return static_cast<size_t>(width) * height; }
+  uint32_t findBestMatchingUnit(const float* instance);
+  uint32_t findBestMatchingUnitExact(const float* instance);
+  Candidate findBestMatchingUnit(const float* instance, size_t first, size_t last) const;
+  uint32_t findBestMatchingUnitApproximate(const float* instance) const;
+  void buildPyramid();
+  void updatePyramid(Region region);
+  void updateNeighbourhood(const float* instance, int bmuX, int bmuY, float radius, float learningRate);
+  void updateRows(const float* instance, int bmuX, int bmuY, int firstRow, int lastRow, float radius2, float learningRate);
+
+  dkm::thread_pool& threadPool;
+
+  int numFeatures { 0 };
+  std::array<float, maxFeatures> minInstance {};
+  std::array<float, maxFeatures> maxInstance {};
+  int width { 0 };
+  int height { 0 };
+  double initialLearningRate { 0.1 };
+  int numIterations { 3000 };
+  uint32_t seed { 0 };
+
+  std::vector<float> weights; // numFeatures planes of width * height
+  uint64_t iteration { 0 };
+  double mapRadius { 1.0 };
+  double timeConstant { 1.0 };
+
+  std::vector<Candidate> bandCandidates;
+  std::vector<float> columnFalloff; // exp(-dx^2 / (2 radius^2)) for the current update
+  Region lastUpdateRegion {};
+
+  bool approximateSearch { false };
+  float exactFallbackRate { 0.0 };
+  float exactFallbackCredit { 0.0 }; // an exact search is due when this reaches 1
+  std::vector<Level> pyramid; // finest first; empty while approximateSearch is off
+  uint32_t previousBestMatchingUnit { 0 };
+  SearchStats searchStats {};
+};
+
+std::string toString(const SelfOrganizingMap::SearchStats& stats);
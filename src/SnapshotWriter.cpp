@@ -0,0 +1,280 @@
+#include "SnapshotWriter.h"
+#include <zlib.h>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+using File = std::unique_ptr<std::FILE, int (*)(std::FILE*)>;
+
+File openFile(const std::string& path) {
+  return File(std::fopen(path.c_str(), "wb"), std::fclose);
+}
+
+void putBigEndian32(std::vector<unsigned char>& bytes, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) bytes.push_back((value >> shift) & 0xff);
+}
+
+void putLittleEndian(std::vector<unsigned char>& bytes, uint32_t value, int size) {
+  for (int i = 0; i < size; i++) bytes.push_back((value >> (i * 8)) & 0xff);
+}
+
+bool writePngChunk(std::FILE* file, const char* type, const unsigned char* data, size_t size) {
+  std::vector<unsigned char> header;
+  putBigEndian32(header, size);
+  header.insert(header.end(), type, type + 4);
+  uLong crc = crc32(crc32(0, Z_NULL, 0), header.data() + 4, 4);
+  if (size > 0) crc = crc32(crc, data, size);
+  std::vector<unsigned char> trailer;
+  putBigEndian32(trailer, crc);
+  return std::fwrite(header.data(), 1, header.size(), file) == header.size()
+      && (size == 0 || std::fwrite(data, 1, size, file) == size)
+      && std::fwrite(trailer.data(), 1, trailer.size(), file) == trailer.size();
+}
+
+// Each strip's rows get the Sub filter, which only looks within the row, and are deflated as a raw stream
+// ending on a byte boundary (the last one finished), so the strips concatenate into one deflate stream
+// and their checksums combine into the zlib stream's.
+bool writePng(std::FILE* file, const unsigned char* rgb, int width, int height, int level, dkm::thread_pool& threadPool) {
+  const size_t rowBytes = static_cast<size_t>(width) * 3;
+  const int stripRows = std::max<int>(16, (height + threadPool.size() * 4 - 1) / (threadPool.size() * 4));
+  const size_t stripCount = (height + stripRows - 1) / stripRows;
+  std::vector<std::vector<unsigned char>> strips(stripCount);
+  std::vector<uLong> adlers(stripCount);
+  std::vector<size_t> filteredSizes(stripCount);
+  std::atomic<bool> failed { false };
+
+  threadPool.parallel_for(stripCount, [&](size_t s) {
+    int firstRow = s * stripRows, endRow = std::min(height, firstRow + stripRows);
+    std::vector<unsigned char> filtered((rowBytes + 1) * (endRow - firstRow));
+    unsigned char* out = filtered.data();
+    for (int y = firstRow; y < endRow; y++) {
+      const unsigned char* row = rgb + y * rowBytes;
+      *out++ = 1; // Sub
+      for (size_t x = 0; x < 3; x++) *out++ = row[x];
+      for (size_t x = 3; x < rowBytes; x++) *out++ = row[x] - row[x - 3];
+    }
+    adlers[s] = adler32(adler32(0, Z_NULL, 0), filtered.data(), filtered.size());
+    filteredSizes[s] = filtered.size();
+
+    z_stream stream {};
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      failed = true;
+      return;
+    }
+    bool last = s == stripCount - 1;
+    std::vector<unsigned char>& strip = strips[s];
+    strip.resize(deflateBound(&stream, filtered.size()) + 64);
+    stream.next_in = filtered.data();
+    stream.avail_in = filtered.size();
+    stream.next_out = strip.data();
+    stream.avail_out = strip.size();
+    for (;;) {
+      int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+      if (result == Z_STREAM_ERROR) {
+        failed = true;
+        break;
+      }
+      if (last ? result == Z_STREAM_END : stream.avail_out != 0) break;
+      size_t used = strip.size() - stream.avail_out;
+      strip.resize(strip.size() * 2);
+      stream.next_out = strip.data() + used;
+      stream.avail_out = strip.size() - used;
+    }
+    strip.resize(strip.size() - stream.avail_out);
+    deflateEnd(&stream);
+  });
+  if (failed) return false;
+
+  static const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  std::vector<unsigned char> header;
+  putBigEndian32(header, width);
+  putBigEndian32(header, height);
+  header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bit RGB, deflate, adaptive filtering, not interlaced
+  // zlib header, with the compression level hint
+  const unsigned char zlibHeader[] = { 0x78, static_cast<unsigned char>(level <= 1 ? 0x01 : level <= 5 ? 0x5e : level == 6 ? 0x9c : 0xda) };
+  uLong adler = adler32(0, Z_NULL, 0);
+  for (size_t s = 0; s < stripCount; s++) adler = adler32_combine(adler, adlers[s], filteredSizes[s]);
+  std::vector<unsigned char> zlibTrailer;
+  putBigEndian32(zlibTrailer, adler);
+
+  if (std::fwrite(signature, 1, sizeof(signature), file) != sizeof(signature)) return false;
+  if (!writePngChunk(file, "IHDR", header.data(), header.size())) return false;
+  if (!writePngChunk(file, "IDAT", zlibHeader, sizeof(zlibHeader))) return false;
+  for (const auto& strip : strips) {
+    if (!writePngChunk(file, "IDAT", strip.data(), strip.size())) return false;
+  }
+  if (!writePngChunk(file, "IDAT", zlibTrailer.data(), zlibTrailer.size())) return false;
+  return writePngChunk(file, "IEND", nullptr, 0);
+}
+
+// Baseline uncompressed RGB TIFF, as one strip
+bool writeTiff(std::FILE* file, const unsigned char* rgb, int width, int height) {
+  constexpr uint32_t entryCount = 13;
+  constexpr uint32_t ifdOffset = 8;
+  constexpr uint32_t bitsPerSampleOffset = ifdOffset + 2 + entryCount * 12 + 4;
+  constexpr uint32_t xResolutionOffset = bitsPerSampleOffset + 6;
+  constexpr uint32_t yResolutionOffset = xResolutionOffset + 8;
+  constexpr uint32_t dataOffset = yResolutionOffset + 8;
+  const uint32_t dataSize = static_cast<uint32_t>(width) * height * 3;
+  enum Type { SHORT = 3, LONG = 4, RATIONAL = 5 };
+
+  std::vector<unsigned char> header { 'I', 'I', 42, 0 };
+  putLittleEndian(header, ifdOffset, 4);
+  putLittleEndian(header, entryCount, 2);
+  auto entry = [&](uint16_t tag, Type type, uint32_t count, uint32_t value) {
+    putLittleEndian(header, tag, 2);
+    putLittleEndian(header, type, 2);
+    putLittleEndian(header, count, 4);
+    putLittleEndian(header, value, type == SHORT && count == 1 ? 2 : 4);
+    if (type == SHORT && count == 1) putLittleEndian(header, 0, 2);
+  };
+  entry(256, LONG, 1, width); // ImageWidth
+  entry(257, LONG, 1, height); // ImageLength
+  entry(258, SHORT, 3, bitsPerSampleOffset); // BitsPerSample
+  entry(259, SHORT, 1, 1); // Compression: none
+  entry(262, SHORT, 1, 2); // PhotometricInterpretation: RGB
+  entry(273, LONG, 1, dataOffset); // StripOffsets
+  entry(277, SHORT, 1, 3); // SamplesPerPixel
+  entry(278, LONG, 1, height); // RowsPerStrip
+  entry(279, LONG, 1, dataSize); // StripByteCounts
+  entry(282, RATIONAL, 1, xResolutionOffset); // XResolution
+  entry(283, RATIONAL, 1, yResolutionOffset); // YResolution
+  entry(284, SHORT, 1, 1); // PlanarConfiguration: interleaved
+  entry(296, SHORT, 1, 2); // ResolutionUnit: inch
+  putLittleEndian(header, 0, 4); // no more IFDs
+  for (int i = 0; i < 3; i++) putLittleEndian(header, 8, 2);
+  for (int i = 0; i < 2; i++) {
+    putLittleEndian(header, 72, 4);
+    putLittleEndian(header, 1, 4);
+  }
+
+  return std::fwrite(header.data(), 1, header.size(), file) == header.size()
+      && std::fwrite(rgb, 1, dataSize, file) == dataSize;
+}
+
+bool writePpm(std::FILE* file, const unsigned char* rgb, int width, int height) {
+  const size_t dataSize = static_cast<size_t>(width) * height * 3;
+  return std::fprintf(file, "P6\n%d %d\n255\n", width, height) > 0
+      && std::fwrite(rgb, 1, dataSize, file) == dataSize;
+}
+
+}
+
+SnapshotWriter::SnapshotWriter(dkm::thread_pool& threadPool_) :
+threadPool(threadPool_),
+thread([this] { run(); })
+{}
+
+SnapshotWriter::~SnapshotWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  snapshotQueued.notify_one();
+  thread.join();
+}
+
+bool SnapshotWriter::capture(const ofFbo& fbo, const std::string& path, Format format, int pngLevel) {
+  // only the render thread frees snapshots, so one found free stays free
+  auto snapshot = std::find_if(snapshots.begin(), snapshots.end(), [this](const Snapshot& s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return s.state == State::free;
+  });
+  if (snapshot == snapshots.end()) {
+    refusedCount++;
+    return false;
+  }
+
+  snapshot->width = fbo.getWidth();
+  snapshot->height = fbo.getHeight();
+  size_t size = static_cast<size_t>(snapshot->width) * snapshot->height * 3;
+  if (snapshot->pixelBufferSize != size) {
+    snapshot->pixelBuffer.allocate(size, GL_STREAM_READ);
+    snapshot->pixelBufferSize = size;
+  }
+  fbo.getTexture().copyTo(snapshot->pixelBuffer);
+  snapshot->path = path;
+  snapshot->format = format;
+  snapshot->pngLevel = ofClamp(pngLevel, 0, 9);
+  snapshot->frame = ofGetFrameNum();
+  std::lock_guard<std::mutex> lock(mutex);
+  snapshot->state = State::readingBack;
+  return true;
+}
+
+void SnapshotWriter::update() {
+  for (size_t i = 0; i < snapshots.size(); i++) {
+    Snapshot& snapshot = snapshots[i];
+    State state;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      state = snapshot.state;
+    }
+
+    if (state == State::readingBack && snapshot.frame < ofGetFrameNum()) {
+      snapshot.pixels = snapshot.pixelBuffer.map<unsigned char>(GL_READ_ONLY);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (snapshot.pixels) {
+        snapshot.state = State::queued;
+        writeQueue.push_back(i);
+        snapshotQueued.notify_one();
+      } else {
+        snapshot.pixelBuffer.unmap();
+        snapshot.state = State::free;
+        failedCount++;
+      }
+    } else if (state == State::written) {
+      snapshot.pixelBuffer.unmap();
+      snapshot.pixels = nullptr;
+      std::lock_guard<std::mutex> lock(mutex);
+      snapshot.state = State::free;
+    }
+  }
+}
+
+std::string SnapshotWriter::getStatsString() const {
+  std::ostringstream ss;
+  ss << "snapshots: " << writtenCount << " written (last " << lastWriteSeconds << "s), "
+     << failedCount << " failed, " << refusedCount << " refused";
+  return ss.str();
+}
+
+void SnapshotWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    snapshotQueued.wait(lock, [this] { return stopping || !writeQueue.empty(); });
+    if (stopping) return;
+    Snapshot& snapshot = snapshots[writeQueue.front()];
+    writeQueue.pop_front();
+    snapshot.state = State::writing;
+    lock.unlock();
+
+    auto start = std::chrono::steady_clock::now();
+    if (write(snapshot)) {
+      writtenCount++;
+      lastWriteSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    } else {
+      failedCount++;
+      ofLogError("SnapshotWriter") << "couldn't write " << snapshot.path;
+    }
+
+    lock.lock();
+    snapshot.state = State::written;
+  }
+}
+
+bool SnapshotWriter::write(const Snapshot& snapshot) {
+  static const char* extensions[] = { ".png", ".tif", ".ppm" };
+  File file = openFile(snapshot.path + extensions[static_cast<int>(snapshot.format)]);
+  if (!file) return false;
+  switch (snapshot.format) {
+    case Format::png: return writePng(file.get(), snapshot.pixels, snapshot.width, snapshot.height, snapshot.pngLevel, threadPool);
+    case Format::tiff: return writeTiff(file.get(), snapshot.pixels, snapshot.width, snapshot.height);
+    case Format::ppm: return writePpm(file.get(), snapshot.pixels, snapshot.width, snapshot.height);
+  }
+  return false;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "dkm_parallel.hpp"
+#include "ofMain.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Saves full-resolution stills of an RGB fbo without holding up the render thread.
+// A capture queues a transfer of the fbo into a pixel buffer, which is mapped a frame later and written
+// out straight from the mapping by a writer thread, then handed back to be unmapped. PNGs are filtered
+// and deflated in strips across the thread pool it's given, the strips joined into one stream as pigz
+// does; TIFF and PPM are written uncompressed, for speed. At most maxQueued snapshots are in flight, and
+// captures beyond that are refused. Snapshots still queued when the app exits are lost.
+class SnapshotWriter {
+public:
+  enum class Format { png, tiff, ppm };
+  static constexpr size_t maxQueued = 2;
+
+  // threadPool is best kept small, so a write doesn't take every core from the frame
+  explicit SnapshotWriter(dkm::thread_pool& threadPool);
+  ~SnapshotWriter();
+
+  // Start a snapshot of fbo, to be saved at path plus the format's extension; false if too many are in flight
+  bool capture(const ofFbo& fbo, const std::string& path, Format format, int pngLevel);
+  // Hand readbacks from earlier frames to the writer, and release the written ones; call every frame
+  void update();
+
+  uint64_t getWrittenCount() const { return writtenCount; }
+  uint64_t getFailedCount() const { return failedCount; }
+  uint64_t getRefusedCount() const { return refusedCount; }
+  std::string getStatsString() const;
+
+private:
+  enum class State { free, readingBack, queued, writing, written };
+
+  struct Snapshot {
+    State state { State::free };
+    ofBufferObject pixelBuffer;
+    size_t pixelBufferSize { 0 };
+    int width { 0 };
+    int height { 0 };
+    std::string path;
+    Format format { Format::png };
+    int pngLevel { 6 };
+    uint64_t frame { 0 }; // when the readback was queued
+    const unsigned char* pixels { nullptr }; // mapped, while queued or writing
+  };
+
+  void run();
+  bool write(const Snapshot& snapshot);
+
+  std::array<Snapshot, maxQueued> snapshots;
+  dkm::thread_pool& threadPool;
+
+  std::mutex mutex; // guards the snapshots' states once they've been handed to the writer
+  std::condition_variable snapshotQueued;
+  std::deque<size_t> writeQueue;
+  bool stopping { false };
+
+  std::atomic<uint64_t> writtenCount { 0 };
+  std::atomic<uint64_t> failedCount { 0 };
+  std::atomic<uint64_t> refusedCount { 0 };
+  std::atomic<float> lastWriteSeconds { 0.0 };
+
+  std::thread thread; // last, so everything it uses exists before it starts
+};
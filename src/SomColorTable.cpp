@@ -0,0 +1,21 @@
+#include "SomColorTable.h"
+
+void SomColorTable::update(const SelfOrganizingMap& som) {
+  width = som.getWidth();
+  height = som.getHeight();
+  rgbs.assign(static_cast<size_t>(width) * height * 3, 0.0);
+  update(som, { 0, 0, width - 1, height - 1 });
+}
+
+void SomColorTable::update(const SelfOrganizingMap& som, const SelfOrganizingMap::Region& region) {
+  int channels = std::min(som.getNumFeatures(), 3);
+  for (int c = 0; c < channels; c++) {
+    const float* plane = som.getPlane(c);
+    for (int y = region.firstRow; y <= region.lastRow; y++) {
+      size_t rowStart = static_cast<size_t>(y) * width;
+      for (int x = region.firstColumn; x <= region.lastColumn; x++) {
+        rgbs[(rowStart + x) * 3 + c] = plane[rowStart + x];
+      }
+    }
+  }
+}
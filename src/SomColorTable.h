@@ -0,0 +1,68 @@
+#pragma once
+
+#include "SelfOrganizingMap.h"
+#include "ofColor.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// The SOM's first three features as RGB, copied out of the map once per update so colouring a note is
+// an inlined lookup rather than a call into the map. Positions are in the unit square and clamped to it.
+// Lookups take the nearest node like SelfOrganizingMap::getMapAt, or blend the four nearest when bilinear.
+class SomColorTable {
+public:
+  // Copy the whole map, or just the region an update changed
+  void update(const SelfOrganizingMap& som);
+  void update(const SelfOrganizingMap& som, const SelfOrganizingMap::Region& region);
+
+  void setBilinear(bool bilinear_) { bilinear = bilinear_; }
+
+  ofFloatColor at(float x, float y) const { return bilinear ? bilinearAt(x, y) : nearestAt(x, y); }
+
+  // Colour points[first] to points[last - 1] into colors, for any container of 2D points like NoteHistory::PointView
+  template <typename Points>
+  void at(const Points& points, size_t first, size_t last, std::vector<ofFloatColor>& colors) const {
+    colors.resize(last - first);
+    if (bilinear) {
+      for (size_t i = first; i < last; i++) { const auto p = points[i]; colors[i - first] = bilinearAt(p[0], p[1]); }
+    } else {
+      for (size_t i = first; i < last; i++) { const auto p = points[i]; colors[i - first] = nearestAt(p[0], p[1]); }
+    }
+  }
+
+private:
+  // the node under x * size, with the negated comparison also sending NaN to the first node
+  static int nodeCoordinate(float x, int size) {
+    return !(x > 0.0f) ? 0 : static_cast<int>(std::min(x * size, size - 1.0f));
+  }
+
+  ofFloatColor colorAt(size_t i) const { return { rgbs[i * 3], rgbs[i * 3 + 1], rgbs[i * 3 + 2], 1.0 }; }
+
+  ofFloatColor nearestAt(float x, float y) const {
+    return colorAt(static_cast<size_t>(nodeCoordinate(y, height)) * width + nodeCoordinate(x, width));
+  }
+
+  ofFloatColor bilinearAt(float x, float y) const {
+    // between node centres, which are half a node in from the edges
+    float fx = std::clamp(x * width - 0.5f, 0.0f, width - 1.0f);
+    float fy = std::clamp(y * height - 0.5f, 0.0f, height - 1.0f);
+    if (!(fx == fx) || !(fy == fy)) return colorAt(0);
+    int x0 = static_cast<int>(fx), y0 = static_cast<int>(fy);
+    int x1 = std::min(x0 + 1, width - 1), y1 = std::min(y0 + 1, height - 1);
+    float tx = fx - x0, ty = fy - y0;
+    const float* row0 = rgbs.data() + static_cast<size_t>(y0) * width * 3;
+    const float* row1 = rgbs.data() + static_cast<size_t>(y1) * width * 3;
+    ofFloatColor color { 0.0, 0.0, 0.0, 1.0 };
+    for (int c = 0; c < 3; c++) {
+      float top = row0[x0 * 3 + c] + (row0[x1 * 3 + c] - row0[x0 * 3 + c]) * tx;
+      float bottom = row1[x0 * 3 + c] + (row1[x1 * 3 + c] - row1[x0 * 3 + c]) * tx;
+      color[c] = top + (bottom - top) * ty;
+    }
+    return color;
+  }
+
+  int width { 1 };
+  int height { 1 };
+  std::vector<float> rgbs { 0.0, 0.0, 0.0 }; // interleaved, row by row
+  bool bilinear { false };
+};
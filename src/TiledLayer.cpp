@@ -0,0 +1,86 @@
+#include "TiledLayer.h"
+#include <algorithm>
+#include <cassert>
+
+namespace {
+
+constexpr size_t maxSpareFbos = 4;
+
+}
+
+int TiledLayer::tileLength(int length, int tileSize) {
+  int count = std::max(1, (length + tileSize - 1) / tileSize);
+  return (length + count - 1) / count; // the last tile may hang over the edge by a few pixels
+}
+
+void TiledLayer::allocate(int width_, int height_, int tileSize, GLint internalFormat_, size_t maxTiles_) {
+  width = width_;
+  height = height_;
+  tileWidth = tileLength(width, tileSize);
+  tileHeight = tileLength(height, tileSize);
+  columns = (width + tileWidth - 1) / tileWidth;
+  rows = (height + tileHeight - 1) / tileHeight;
+  internalFormat = internalFormat_;
+  maxTiles = std::max<size_t>(1, maxTiles_);
+  tiles.clear();
+  tiles.resize(columns * rows);
+  liveTileCount = 0;
+  spareFbos.clear();
+}
+
+PingPongFbo* TiledLayer::acquire(int column, int row, const TileRange& keep) {
+  Tile& tile = tiles[row * columns + column];
+  if (tile.fbo) return tile.fbo.get();
+
+  if (liveTileCount == maxTiles) {
+    Tile* faintest = nullptr;
+    for (int r = 0; r < rows; r++) {
+      for (int c = 0; c < columns; c++) {
+        Tile& candidate = tiles[r * columns + c];
+        if (!candidate.fbo || keep.contains(c, r)) continue;
+        if (!faintest || candidate.bound < faintest->bound) faintest = &candidate;
+      }
+    }
+    if (!faintest) return nullptr;
+    release(*faintest);
+    evictedCount++;
+  }
+
+  if (spareFbos.empty()) {
+    tile.fbo = std::make_unique<PingPongFbo>();
+    tile.fbo->allocate(tileWidth, tileHeight, internalFormat);
+    allocatedCount++;
+  } else {
+    tile.fbo = std::move(spareFbos.back());
+    spareFbos.pop_back();
+  }
+  assert(liveTileCount + spareFbos.size() < maxTiles);
+  tile.fbo->getSource().clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
+  tile.bound = 0.0;
+  liveTileCount++;
+  return tile.fbo.get();
+}
+
+void TiledLayer::release(Tile& tile) {
+  liveTileCount--;
+  // spares count towards maxTiles, so the fbos in existence never exceed what the budget allows for
+  if (spareFbos.size() < maxSpareFbos && liveTileCount + spareFbos.size() < maxTiles) spareFbos.push_back(std::move(tile.fbo));
+  tile.fbo.reset();
+  tile.bound = 0.0;
+}
+
+void TiledLayer::draw(float x, float y, float w, float h) {
+  float scaleX = w / width, scaleY = h / height;
+  for (int row = 0; row < rows; row++) {
+    for (int column = 0; column < columns; column++) {
+      const Tile& tile = tiles[row * columns + column];
+      if (!tile.fbo) continue;
+      tile.fbo->draw(x + column * tileWidth * scaleX, y + row * tileHeight * scaleY, tileWidth * scaleX, tileHeight * scaleY);
+    }
+  }
+}
+
+std::string TiledLayer::getStatsString() const {
+  return "tiles: " + ofToString(liveTileCount) + "/" + ofToString(tiles.size()) + " live (max " + ofToString(maxTiles) + ")"
+    + " allocated " + ofToString(allocatedCount) + " freed " + ofToString(freedCount) + " evicted " + ofToString(evictedCount);
+}
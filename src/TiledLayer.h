@@ -0,0 +1,114 @@
+#pragma once
+
+#include "ofMain.h"
+#include "PingPongFbo.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// A canvas layer stored as a grid of tiles, of which only those that have been drawn into and haven't
+// faded away are allocated, so memory and the cost of fading and compositing follow what's on the layer
+// rather than its area.
+// Each tile keeps an upper bound on its brightest channel: a draw adds the bound the caller gives for it,
+// and a fade multiplies it. Once the bound is below one 8-bit step the tile can't show in the composite and
+// is freed. If maxTiles are live and another is needed, the faintest one the draw doesn't cover is freed to
+// make room, and if there is none the rest of the draw is skipped. Freed tiles kept for reuse count towards
+// maxTiles too, so no more than maxTiles tiles' fbos ever exist.
+class TiledLayer {
+public:
+  static constexpr float freeThreshold = 1.0 / 255.0;
+
+  // Tiles are at most tileSize square, adjusted to divide the layer evenly
+  static int tileLength(int length, int tileSize);
+  void allocate(int width, int height, int tileSize, GLint internalFormat, size_t maxTiles);
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  int getTileWidth() const { return tileWidth; }
+  int getTileHeight() const { return tileHeight; }
+  size_t getLiveTileCount() const { return liveTileCount; }
+  std::string getStatsString() const;
+
+  // Call drawFn once for each tile that bounds (normalised) overlaps, inside the tile's fbo and translated so
+  // it can draw in layer coordinates. addedBound is the most the drawing adds to any channel of a pixel.
+  template<typename DrawFn>
+  void draw(const ofRectangle& bounds, float addedBound, DrawFn drawFn);
+
+  // Call fadeFn(PingPongFbo&) on each live tile to fade it by fade, freeing those that have faded out
+  template<typename FadeFn>
+  void fade(float fade, FadeFn fadeFn);
+
+  // Draw the live tiles as though the layer were one texture drawn at (x, y, w, h)
+  void draw(float x, float y, float w, float h);
+
+private:
+  struct Tile {
+    std::unique_ptr<PingPongFbo> fbo; // null while the tile is empty
+    float bound { 0.0 };
+  };
+
+  // Inclusive
+  struct TileRange {
+    int firstColumn, firstRow, lastColumn, lastRow;
+    bool contains(int column, int row) const { return column >= firstColumn && column <= lastColumn && row >= firstRow && row <= lastRow; }
+  };
+
+  // The tile's fbo, allocating it if need be without evicting anything in keep, or null if that isn't possible
+  PingPongFbo* acquire(int column, int row, const TileRange& keep);
+  void release(Tile& tile);
+
+  int width { 0 };
+  int height { 0 };
+  int columns { 0 };
+  int rows { 0 };
+  int tileWidth { 0 };
+  int tileHeight { 0 };
+  GLint internalFormat { GL_RGBA };
+  size_t maxTiles { 0 };
+
+  std::vector<Tile> tiles; // columns * rows, row by row
+  size_t liveTileCount { 0 };
+  std::vector<std::unique_ptr<PingPongFbo>> spareFbos; // a few freed tiles, kept to save reallocating while there's room under maxTiles
+  uint64_t allocatedCount { 0 };
+  uint64_t freedCount { 0 };
+  uint64_t evictedCount { 0 };
+};
+
+template<typename DrawFn>
+void TiledLayer::draw(const ofRectangle& bounds, float addedBound, DrawFn drawFn) {
+  TileRange range {
+    std::max(0, static_cast<int>(bounds.getLeft() * width / tileWidth)),
+    std::max(0, static_cast<int>(bounds.getTop() * height / tileHeight)),
+    std::min(columns - 1, static_cast<int>(bounds.getRight() * width / tileWidth)),
+    std::min(rows - 1, static_cast<int>(bounds.getBottom() * height / tileHeight))
+  };
+  for (int row = range.firstRow; row <= range.lastRow; row++) {
+    for (int column = range.firstColumn; column <= range.lastColumn; column++) {
+      PingPongFbo* fbo = acquire(column, row, range);
+      if (!fbo) return;
+      fbo->getSource().begin();
+      ofPushMatrix();
+      ofTranslate(-column * tileWidth, -row * tileHeight);
+      drawFn();
+      ofPopMatrix();
+      fbo->getSource().end();
+      Tile& tile = tiles[row * columns + column];
+      tile.bound += addedBound;
+      if (internalFormat == GL_RGBA8) tile.bound = std::min(tile.bound, 1.0f); // clamped when stored
+    }
+  }
+}
+
+template<typename FadeFn>
+void TiledLayer::fade(float fade, FadeFn fadeFn) {
+  for (auto& tile : tiles) {
+    if (!tile.fbo) continue;
+    tile.bound *= fade;
+    if (tile.bound < freeThreshold) {
+      release(tile);
+      freedCount++;
+      continue;
+    }
+    fadeFn(*tile.fbo);
+  }
+}
@@ -7,13 +7,23 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <random>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#if !defined(DKM_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#include <immintrin.h>
+#elif !defined(DKM_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+#include <arm_neon.h>
+#endif
+
 /*
 DKM - A k-means implementation that is generic across variable data dimensions.
 */
@@ -47,55 +57,228 @@ T distance(const std::array<T, N>& point_a, const std::array<T, N>& point_b) {
 Calculate the smallest distance between each of the data points and any of the input means.
 */
 template <typename T, size_t N>
-std::vector<T> closest_distance(
-	const std::vector<std::array<T, N>>& means, const std::vector<std::array<T, N>>& data) {
-	std::vector<T> distances;
-	distances.reserve(data.size());
-	for (auto& d : data) {
-		T closest = distance_squared(d, means[0]);
+void closest_distance(const std::vector<std::array<T, N>>& means, const std::vector<std::array<T, N>>& data,
+	std::vector<T>& distances) {
+	distances.resize(data.size());
+	for (size_t i = 0; i < data.size(); ++i) {
+		T closest = distance_squared(data[i], means[0]);
 		for (auto& m : means) {
-			T distance = distance_squared(d, m);
+			T distance = distance_squared(data[i], m);
 			if (distance < closest)
 				closest = distance;
 		}
-		distances.push_back(closest);
+		distances[i] = closest;
 	}
+}
+
+template <typename T, size_t N>
+std::vector<T> closest_distance(
+	const std::vector<std::array<T, N>>& means, const std::vector<std::array<T, N>>& data) {
+	std::vector<T> distances;
+	closest_distance(means, data, distances);
 	return distances;
 }
 
+/*
+Pick an index at random with probability proportional to its (non-negative) weight, or uniformly if
+all the weights are zero. Unlike std::discrete_distribution this works in place without allocating.
+The first overload takes the sum of the weights (accumulated in order as a double) when the caller
+already has it.
+*/
+template <typename T, typename RandomEngine>
+size_t weighted_random_index(const std::vector<T>& weights, double total, RandomEngine& rand_engine) {
+	assert(!weights.empty());
+	if (!(total > 0.0)) {
+		std::uniform_int_distribution<size_t> uniform_generator(0, weights.size() - 1);
+		return uniform_generator(rand_engine);
+	}
+	std::uniform_real_distribution<double> uniform_generator(0.0, total);
+	double target = uniform_generator(rand_engine);
+	double cumulative = 0.0;
+	for (size_t i = 0; i < weights.size(); ++i) {
+		cumulative += static_cast<double>(weights[i]);
+		if (target < cumulative) {
+			return i;
+		}
+	}
+	// rounding can leave the target just past the final cumulative weight
+	size_t last = weights.size() - 1;
+	while (last > 0 && !(weights[last] > T())) {
+		--last;
+	}
+	return last;
+}
+
+template <typename T, typename RandomEngine>
+size_t weighted_random_index(const std::vector<T>& weights, RandomEngine& rand_engine) {
+	double total = 0.0;
+	for (T w : weights) {
+		total += static_cast<double>(w);
+	}
+	return weighted_random_index(weights, total, rand_engine);
+}
+
 /*
 This is an alternate initialization method based on the [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B)
-initialization algorithm.
+initialization algorithm. The means are written into `means`, using `distances` as scratch space, so
+repeated calls reuse their storage.
+
+`distances` holds the squared distance from each point to its closest mean so far, and is only updated
+against the newest mean, so choosing k means costs O(n * k) rather than O(n * k^2).
 */
 template <typename T, size_t N>
-std::vector<std::array<T, N>> random_plusplus(const std::vector<std::array<T, N>>& data, uint32_t k, uint64_t seed) {
+void random_plusplus(const std::vector<std::array<T, N>>& data, uint32_t k, uint64_t seed,
+	std::vector<std::array<T, N>>& means, std::vector<T>& distances) {
 	assert(k > 0);
 	assert(data.size() > 0);
-	using input_size_t = typename std::array<T, N>::size_type;
-	std::vector<std::array<T, N>> means;
+	means.clear();
 	// Using a very simple PRBS generator, parameters selected according to
 	// https://en.wikipedia.org/wiki/Linear_congruential_generator#Parameters_in_common_use
 	std::linear_congruential_engine<uint64_t, 6364136223846793005, 1442695040888963407, UINT64_MAX> rand_engine(seed);
 
 	// Select first mean at random from the set
 	{
-		std::uniform_int_distribution<input_size_t> uniform_generator(0, data.size() - 1);
+		std::uniform_int_distribution<size_t> uniform_generator(0, data.size() - 1);
 		means.push_back(data[uniform_generator(rand_engine)]);
 	}
+	distances.resize(data.size());
+	for (size_t i = 0; i < data.size(); ++i) {
+		distances[i] = distance_squared(data[i], means[0]);
+	}
 
 	for (uint32_t count = 1; count < k; ++count) {
-		// Calculate the distance to the closest mean for each data point
-		auto distances = details::closest_distance(means, data);
 		// Pick a random point weighted by the distance from existing means
-		// TODO: This might convert floating point weights to ints, distorting the distribution for small weights
-#if !defined(_MSC_VER) || _MSC_VER >= 1900
-		std::discrete_distribution<input_size_t> generator(distances.begin(), distances.end());
-#else  // MSVC++ older than 14.0
-		input_size_t i = 0;
-		std::discrete_distribution<input_size_t> generator(distances.size(), 0.0, 0.0, [&distances, &i](double) { return distances[i++]; });
-#endif
-		means.push_back(data[generator(rand_engine)]);
+		double total = 0.0;
+		for (T d : distances) {
+			total += static_cast<double>(d);
+		}
+		means.push_back(data[weighted_random_index(distances, total, rand_engine)]);
+		if (count + 1 == k) break;
+		// Only the newest mean can be closer than the closest so far
+		const auto& newest = means.back();
+		for (size_t i = 0; i < data.size(); ++i) {
+			distances[i] = std::min(distances[i], distance_squared(data[i], newest));
+		}
+	}
+}
+
+/*
+kmeans++ for weighted data, where each point counts `weights[i]` times: the first mean is picked in
+proportion to the weights, and subsequent means in proportion to weight times squared distance.
+`distances` holds those products.
+*/
+template <typename T, size_t N>
+void random_plusplus(const std::vector<std::array<T, N>>& data, const std::vector<T>& weights, uint32_t k,
+	uint64_t seed, std::vector<std::array<T, N>>& means, std::vector<T>& distances) {
+	assert(k > 0);
+	assert(data.size() > 0);
+	assert(weights.size() == data.size());
+	means.clear();
+	std::linear_congruential_engine<uint64_t, 6364136223846793005, 1442695040888963407, UINT64_MAX> rand_engine(seed);
+
+	means.push_back(data[weighted_random_index(weights, rand_engine)]);
+	distances.resize(data.size());
+	for (size_t i = 0; i < data.size(); ++i) {
+		distances[i] = weights[i] * distance_squared(data[i], means[0]);
+	}
+
+	for (uint32_t count = 1; count < k; ++count) {
+		double total = 0.0;
+		for (T d : distances) {
+			total += static_cast<double>(d);
+		}
+		means.push_back(data[weighted_random_index(distances, total, rand_engine)]);
+		if (count + 1 == k) break;
+		const auto& newest = means.back();
+		for (size_t i = 0; i < data.size(); ++i) {
+			distances[i] = std::min(distances[i], weights[i] * distance_squared(data[i], newest));
+		}
+	}
+}
+
+/*
+An approximation to kmeans++ using the [AFK-MC2](https://papers.nips.cc/paper/6478-fast-and-provably-good-seedings-for-k-means)
+Markov chain sampler. Each mean after the first is the end of a Markov chain of `chain_length`
+candidate points drawn from a proposal distribution built in one pass over the data, so only the
+candidates' distances to the chosen means are ever calculated. Choosing k means costs
+O(n + k^2 * chain_length) rather than O(n * k), which is cheaper when the data is large next to
+k * chain_length.
+
+`proposal` is scratch space for the cumulative proposal distribution.
+*/
+template <typename T, size_t N>
+void random_afk_mc2(const std::vector<std::array<T, N>>& data, uint32_t k, uint32_t chain_length, uint64_t seed,
+	std::vector<std::array<T, N>>& means, std::vector<double>& proposal) {
+	assert(k > 0);
+	assert(data.size() > 0);
+	assert(chain_length > 0);
+	means.clear();
+	std::linear_congruential_engine<uint64_t, 6364136223846793005, 1442695040888963407, UINT64_MAX> rand_engine(seed);
+
+	// Select first mean at random from the set
+	{
+		std::uniform_int_distribution<size_t> uniform_generator(0, data.size() - 1);
+		means.push_back(data[uniform_generator(rand_engine)]);
 	}
+	if (k == 1) return;
+
+	// The proposal is an even mix of the D^2 distribution from the first mean and the uniform distribution
+	const std::array<T, N> first = means.front(); // copied, as adding means below can reallocate
+	double total = 0.0;
+	for (const auto& point : data) {
+		total += static_cast<double>(distance_squared(point, first));
+	}
+	const double uniform_weight = 0.5 / data.size();
+	const double distance_weight = total > 0.0 ? 0.5 / total : 0.0;
+	auto proposal_probability = [&](size_t i) {
+		double q = distance_weight * static_cast<double>(distance_squared(data[i], first)) + uniform_weight;
+		return total > 0.0 ? q : 2.0 * q;
+	};
+	proposal.resize(data.size());
+	double cumulative = 0.0;
+	for (size_t i = 0; i < data.size(); ++i) {
+		cumulative += proposal_probability(i);
+		proposal[i] = cumulative;
+	}
+
+	std::uniform_real_distribution<double> uniform_generator(0.0, 1.0);
+	auto sample_proposal = [&]() {
+		double target = uniform_generator(rand_engine) * proposal.back();
+		auto it = std::upper_bound(proposal.begin(), proposal.end(), target);
+		return std::min(static_cast<size_t>(it - proposal.begin()), data.size() - 1);
+	};
+	auto closest_distance_squared = [&](size_t i) {
+		T closest = distance_squared(data[i], means[0]);
+		for (size_t j = 1; j < means.size(); ++j) {
+			closest = std::min(closest, distance_squared(data[i], means[j]));
+		}
+		return static_cast<double>(closest);
+	};
+
+	for (uint32_t count = 1; count < k; ++count) {
+		size_t x = sample_proposal();
+		double x_distance = closest_distance_squared(x);
+		double x_probability = proposal_probability(x);
+		for (uint32_t step = 1; step < chain_length; ++step) {
+			size_t y = sample_proposal();
+			double y_distance = closest_distance_squared(y);
+			double y_probability = proposal_probability(y);
+			// Metropolis-Hastings acceptance of y with probability (d(y) q(x)) / (d(x) q(y)), written without division
+			if (y_distance * x_probability > uniform_generator(rand_engine) * x_distance * y_probability) {
+				x = y;
+				x_distance = y_distance;
+				x_probability = y_probability;
+			}
+		}
+		means.push_back(data[x]);
+	}
+}
+
+template <typename T, size_t N>
+std::vector<std::array<T, N>> random_plusplus(const std::vector<std::array<T, N>>& data, uint32_t k, uint64_t seed) {
+	std::vector<std::array<T, N>> means;
+	std::vector<T> distances;
+	random_plusplus(data, k, seed, means, distances);
 	return means;
 }
 
@@ -118,6 +301,316 @@ uint32_t closest_mean(const std::array<T, N>& point, const std::vector<std::arra
 	return index;
 }
 
+/*
+Assignment kernels for float data stored as structure-of-arrays: one column per coordinate for the
+points (`stride` apart) and for the means (`k` apart). Each assigns labels to points [begin, end).
+
+The vector kernels evaluate exactly the same floating point operations, in the same order, as
+`distance_squared` and `closest_mean`, and break ties towards the lower mean index in the same way,
+so labels are identical to the scalar path. Where the compiler contracts `d += delta * delta` into a
+fused multiply-add (clang, or GCC in GNU mode, on targets with FMA) the kernels fuse too; define
+DKM_FP_CONTRACT to 0 or 1 to override that guess. Define DKM_NO_SIMD to use the portable kernel only.
+*/
+#ifndef DKM_FP_CONTRACT
+#if (defined(__FMA__) || defined(__aarch64__)) && (defined(__clang__) || (defined(__GNUC__) && !defined(__STRICT_ANSI__)))
+#define DKM_FP_CONTRACT 1
+#else
+#define DKM_FP_CONTRACT 0
+#endif
+#endif
+
+template <size_t N>
+using column_kernel = void (*)(const float* points, size_t stride, size_t begin, size_t end,
+	const float* means, uint32_t k, uint32_t* labels);
+
+template <size_t N>
+void assign_columns_portable(const float* points, size_t stride, size_t begin, size_t end,
+	const float* means, uint32_t k, uint32_t* labels) {
+	auto column_distance_squared = [=](size_t i, uint32_t m) {
+		float d_squared = 0.0f;
+		for (size_t c = 0; c < N; ++c) {
+			float delta = points[c * stride + i] - means[c * k + m];
+			d_squared += delta * delta;
+		}
+		return d_squared;
+	};
+	for (size_t i = begin; i < end; ++i) {
+		uint32_t index = 0;
+		float smallest_distance = column_distance_squared(i, 0);
+		for (uint32_t m = 1; m < k; ++m) {
+			float d_squared = column_distance_squared(i, m);
+			if (d_squared < smallest_distance) {
+				smallest_distance = d_squared;
+				index = m;
+			}
+		}
+		labels[i] = index;
+	}
+}
+
+#if !defined(DKM_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define DKM_SIMD_SSE2
+
+inline __m128 columns_distance_squared_sse2(const __m128* point, const float* means, uint32_t k, uint32_t m, size_t n) {
+	__m128 delta = _mm_sub_ps(point[0], _mm_set1_ps(means[m]));
+	__m128 d_squared = _mm_mul_ps(delta, delta);
+	for (size_t c = 1; c < n; ++c) {
+		delta = _mm_sub_ps(point[c], _mm_set1_ps(means[c * k + m]));
+#if DKM_FP_CONTRACT
+		d_squared = _mm_fmadd_ps(delta, delta, d_squared);
+#else
+		d_squared = _mm_add_ps(d_squared, _mm_mul_ps(delta, delta));
+#endif
+	}
+	return d_squared;
+}
+
+// 8 points per step, as two 4-wide lanes
+template <size_t N>
+void assign_columns_sse2(const float* points, size_t stride, size_t begin, size_t end,
+	const float* means, uint32_t k, uint32_t* labels) {
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m128 lo[N], hi[N];
+		for (size_t c = 0; c < N; ++c) {
+			lo[c] = _mm_loadu_ps(points + c * stride + i);
+			hi[c] = _mm_loadu_ps(points + c * stride + i + 4);
+		}
+		__m128 smallest_lo = columns_distance_squared_sse2(lo, means, k, 0, N);
+		__m128 smallest_hi = columns_distance_squared_sse2(hi, means, k, 0, N);
+		__m128i index_lo = _mm_setzero_si128();
+		__m128i index_hi = _mm_setzero_si128();
+		for (uint32_t m = 1; m < k; ++m) {
+			__m128i mean_index = _mm_set1_epi32(static_cast<int>(m));
+			__m128 d_lo = columns_distance_squared_sse2(lo, means, k, m, N);
+			__m128 d_hi = columns_distance_squared_sse2(hi, means, k, m, N);
+			__m128i closer_lo = _mm_castps_si128(_mm_cmplt_ps(d_lo, smallest_lo));
+			__m128i closer_hi = _mm_castps_si128(_mm_cmplt_ps(d_hi, smallest_hi));
+			// minps returns its second operand unless the first is strictly smaller, as closest_mean does
+			smallest_lo = _mm_min_ps(d_lo, smallest_lo);
+			smallest_hi = _mm_min_ps(d_hi, smallest_hi);
+			index_lo = _mm_or_si128(_mm_and_si128(closer_lo, mean_index), _mm_andnot_si128(closer_lo, index_lo));
+			index_hi = _mm_or_si128(_mm_and_si128(closer_hi, mean_index), _mm_andnot_si128(closer_hi, index_hi));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(labels + i), index_lo);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(labels + i + 4), index_hi);
+	}
+	assign_columns_portable<N>(points, stride, i, end, means, k, labels);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DKM_SIMD_AVX2
+#if DKM_FP_CONTRACT
+#define DKM_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define DKM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+DKM_TARGET_AVX2 inline __m256 columns_distance_squared_avx2(const __m256* point, const float* means, uint32_t k, uint32_t m, size_t n) {
+	__m256 delta = _mm256_sub_ps(point[0], _mm256_set1_ps(means[m]));
+	__m256 d_squared = _mm256_mul_ps(delta, delta);
+	for (size_t c = 1; c < n; ++c) {
+		delta = _mm256_sub_ps(point[c], _mm256_set1_ps(means[c * k + m]));
+#if DKM_FP_CONTRACT
+		d_squared = _mm256_fmadd_ps(delta, delta, d_squared);
+#else
+		d_squared = _mm256_add_ps(d_squared, _mm256_mul_ps(delta, delta));
+#endif
+	}
+	return d_squared;
+}
+
+// 16 points per step, as two 8-wide lanes; only called when the CPU reports AVX2
+template <size_t N>
+DKM_TARGET_AVX2 void assign_columns_avx2(const float* points, size_t stride, size_t begin, size_t end,
+	const float* means, uint32_t k, uint32_t* labels) {
+	size_t i = begin;
+	for (; i + 16 <= end; i += 16) {
+		__m256 lo[N], hi[N];
+		for (size_t c = 0; c < N; ++c) {
+			lo[c] = _mm256_loadu_ps(points + c * stride + i);
+			hi[c] = _mm256_loadu_ps(points + c * stride + i + 8);
+		}
+		__m256 smallest_lo = columns_distance_squared_avx2(lo, means, k, 0, N);
+		__m256 smallest_hi = columns_distance_squared_avx2(hi, means, k, 0, N);
+		__m256i index_lo = _mm256_setzero_si256();
+		__m256i index_hi = _mm256_setzero_si256();
+		for (uint32_t m = 1; m < k; ++m) {
+			__m256i mean_index = _mm256_set1_epi32(static_cast<int>(m));
+			__m256 d_lo = columns_distance_squared_avx2(lo, means, k, m, N);
+			__m256 d_hi = columns_distance_squared_avx2(hi, means, k, m, N);
+			__m256i closer_lo = _mm256_castps_si256(_mm256_cmp_ps(d_lo, smallest_lo, _CMP_LT_OQ));
+			__m256i closer_hi = _mm256_castps_si256(_mm256_cmp_ps(d_hi, smallest_hi, _CMP_LT_OQ));
+			smallest_lo = _mm256_min_ps(d_lo, smallest_lo);
+			smallest_hi = _mm256_min_ps(d_hi, smallest_hi);
+			index_lo = _mm256_blendv_epi8(index_lo, mean_index, closer_lo);
+			index_hi = _mm256_blendv_epi8(index_hi, mean_index, closer_hi);
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(labels + i), index_lo);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(labels + i + 8), index_hi);
+	}
+	assign_columns_sse2<N>(points, stride, i, end, means, k, labels);
+}
+#endif // GNUC || clang
+
+#elif !defined(DKM_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+#define DKM_SIMD_NEON
+
+inline float32x4_t columns_distance_squared_neon(const float32x4_t* point, const float* means, uint32_t k, uint32_t m, size_t n) {
+	float32x4_t delta = vsubq_f32(point[0], vdupq_n_f32(means[m]));
+	float32x4_t d_squared = vmulq_f32(delta, delta);
+	for (size_t c = 1; c < n; ++c) {
+		delta = vsubq_f32(point[c], vdupq_n_f32(means[c * k + m]));
+#if DKM_FP_CONTRACT
+		d_squared = vfmaq_f32(d_squared, delta, delta);
+#else
+		d_squared = vaddq_f32(d_squared, vmulq_f32(delta, delta));
+#endif
+	}
+	return d_squared;
+}
+
+// 8 points per step, as two 4-wide lanes
+template <size_t N>
+void assign_columns_neon(const float* points, size_t stride, size_t begin, size_t end,
+	const float* means, uint32_t k, uint32_t* labels) {
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8) {
+		float32x4_t lo[N], hi[N];
+		for (size_t c = 0; c < N; ++c) {
+			lo[c] = vld1q_f32(points + c * stride + i);
+			hi[c] = vld1q_f32(points + c * stride + i + 4);
+		}
+		float32x4_t smallest_lo = columns_distance_squared_neon(lo, means, k, 0, N);
+		float32x4_t smallest_hi = columns_distance_squared_neon(hi, means, k, 0, N);
+		uint32x4_t index_lo = vdupq_n_u32(0);
+		uint32x4_t index_hi = vdupq_n_u32(0);
+		for (uint32_t m = 1; m < k; ++m) {
+			uint32x4_t mean_index = vdupq_n_u32(m);
+			float32x4_t d_lo = columns_distance_squared_neon(lo, means, k, m, N);
+			float32x4_t d_hi = columns_distance_squared_neon(hi, means, k, m, N);
+			uint32x4_t closer_lo = vcltq_f32(d_lo, smallest_lo);
+			uint32x4_t closer_hi = vcltq_f32(d_hi, smallest_hi);
+			smallest_lo = vbslq_f32(closer_lo, d_lo, smallest_lo);
+			smallest_hi = vbslq_f32(closer_hi, d_hi, smallest_hi);
+			index_lo = vbslq_u32(closer_lo, mean_index, index_lo);
+			index_hi = vbslq_u32(closer_hi, mean_index, index_hi);
+		}
+		vst1q_u32(labels + i, index_lo);
+		vst1q_u32(labels + i + 4, index_hi);
+	}
+	assign_columns_portable<N>(points, stride, i, end, means, k, labels);
+}
+#endif // architecture
+
+/*
+Pick the widest kernel the CPU running this process supports.
+*/
+template <size_t N>
+column_kernel<N> select_column_kernel() {
+#if defined(DKM_SIMD_AVX2)
+	if (__builtin_cpu_supports("avx2")) {
+		return assign_columns_avx2<N>;
+	}
+#endif
+#if defined(DKM_SIMD_SSE2)
+	return assign_columns_sse2<N>;
+#elif defined(DKM_SIMD_NEON)
+	return assign_columns_neon<N>;
+#else
+	return assign_columns_portable<N>;
+#endif
+}
+
+/*
+Assigns each of a set of data points to its closest mean. The data is loaded once and can then be
+assigned against several sets of means, as Lloyd's algorithm does on each iteration. `prepare` takes
+the means for the next round, after which disjoint ranges of points may be assigned concurrently.
+
+This generic version uses `closest_mean` directly on the data; float data is specialised below.
+*/
+template <typename T, size_t N>
+class cluster_assigner {
+public:
+	cluster_assigner() : _data(nullptr), _means(nullptr) {}
+
+	void load(const std::vector<std::array<T, N>>& data) { _data = &data; }
+
+	size_t size() const { return _data ? _data->size() : 0; }
+
+	void prepare(const std::vector<std::array<T, N>>& means) {
+		assert(!means.empty());
+		_means = &means;
+	}
+
+	void assign_range(size_t begin, size_t end, uint32_t* clusters) const {
+		assert(_data && _means);
+		for (size_t i = begin; i < end; ++i) {
+			clusters[i] = closest_mean((*_data)[i], *_means);
+		}
+	}
+
+	void assign(const std::vector<std::array<T, N>>& means, std::vector<uint32_t>& clusters) {
+		prepare(means);
+		clusters.resize(size());
+		assign_range(0, size(), clusters.data());
+	}
+
+private:
+	const std::vector<std::array<T, N>>* _data;
+	const std::vector<std::array<T, N>>* _means;
+};
+
+/*
+Float data is copied into one column per coordinate so that the SIMD kernels can assign 8 or 16
+points at a time.
+*/
+template <size_t N>
+class cluster_assigner<float, N> {
+public:
+	cluster_assigner() : _stride(0), _k(0) {}
+
+	void load(const std::vector<std::array<float, N>>& data) {
+		_stride = data.size();
+		_columns.resize(N * _stride);
+		for (size_t i = 0; i < _stride; ++i) {
+			for (size_t c = 0; c < N; ++c) {
+				_columns[c * _stride + i] = data[i][c];
+			}
+		}
+	}
+
+	size_t size() const { return _stride; }
+
+	void prepare(const std::vector<std::array<float, N>>& means) {
+		assert(!means.empty());
+		_k = static_cast<uint32_t>(means.size());
+		_mean_columns.resize(N * _k);
+		for (uint32_t m = 0; m < _k; ++m) {
+			for (size_t c = 0; c < N; ++c) {
+				_mean_columns[c * _k + m] = means[m][c];
+			}
+		}
+	}
+
+	void assign_range(size_t begin, size_t end, uint32_t* clusters) const {
+		static const column_kernel<N> kernel = select_column_kernel<N>();
+		kernel(_columns.data(), _stride, begin, end, _mean_columns.data(), _k, clusters);
+	}
+
+	void assign(const std::vector<std::array<float, N>>& means, std::vector<uint32_t>& clusters) {
+		prepare(means);
+		clusters.resize(_stride);
+		assign_range(0, _stride, clusters.data());
+	}
+
+private:
+	size_t _stride;
+	uint32_t _k;
+	std::vector<float> _columns;
+	std::vector<float> _mean_columns;
+};
+
 /*
 Calculate the index of the mean each data point is closest to (euclidean distance).
 */
@@ -125,22 +618,25 @@ template <typename T, size_t N>
 std::vector<uint32_t> calculate_clusters(
 	const std::vector<std::array<T, N>>& data, const std::vector<std::array<T, N>>& means) {
 	std::vector<uint32_t> clusters;
-	for (auto& point : data) {
-		clusters.push_back(closest_mean(point, means));
-	}
+	cluster_assigner<T, N> assigner;
+	assigner.load(data);
+	assigner.assign(means, clusters);
 	return clusters;
 }
 
 /*
-Calculate means based on data points and their cluster assignments.
+Calculate means based on data points and their cluster assignments, writing them into `means` and
+using `count` as scratch space.
 */
 template <typename T, size_t N>
-std::vector<std::array<T, N>> calculate_means(const std::vector<std::array<T, N>>& data,
+void calculate_means(const std::vector<std::array<T, N>>& data,
 	const std::vector<uint32_t>& clusters,
 	const std::vector<std::array<T, N>>& old_means,
-	uint32_t k) {
-	std::vector<std::array<T, N>> means(k);
-	std::vector<T> count(k, T());
+	uint32_t k,
+	std::vector<std::array<T, N>>& means,
+	std::vector<T>& count) {
+	means.assign(k, std::array<T, N>());
+	count.assign(k, T());
 	for (size_t i = 0; i < std::min(clusters.size(), data.size()); ++i) {
 		auto& mean = means[clusters[i]];
 		count[clusters[i]] += 1;
@@ -157,26 +653,57 @@ std::vector<std::array<T, N>> calculate_means(const std::vector<std::array<T, N>
 			}
 		}
 	}
-	return means;
 }
 
+/*
+As above, with each point counting `weights[i]` times; `count` holds each cluster's total weight.
+*/
 template <typename T, size_t N>
-std::vector<T> deltas(
-	const std::vector<std::array<T, N>>& old_means, const std::vector<std::array<T, N>>& means)
-{
-	std::vector<T> distances;
-	distances.reserve(means.size());
-	assert(old_means.size() == means.size());
-	for (size_t i = 0; i < means.size(); ++i) {
-		distances.push_back(distance(means[i], old_means[i]));
+void calculate_means(const std::vector<std::array<T, N>>& data,
+	const std::vector<T>& weights,
+	const std::vector<uint32_t>& clusters,
+	const std::vector<std::array<T, N>>& old_means,
+	uint32_t k,
+	std::vector<std::array<T, N>>& means,
+	std::vector<T>& count) {
+	assert(weights.size() == data.size());
+	means.assign(k, std::array<T, N>());
+	count.assign(k, T());
+	for (size_t i = 0; i < std::min(clusters.size(), data.size()); ++i) {
+		auto& mean = means[clusters[i]];
+		count[clusters[i]] += weights[i];
+		for (size_t j = 0; j < N; ++j) {
+			mean[j] += weights[i] * data[i][j];
+		}
+	}
+	for (size_t i = 0; i < k; ++i) {
+		if (!(count[i] > T())) {
+			means[i] = old_means[i];
+		} else {
+			for (size_t j = 0; j < N; ++j) {
+				means[i][j] /= count[i];
+			}
+		}
 	}
-	return distances;
 }
 
-template <typename T>
-bool deltas_below_limit(const std::vector<T>& deltas, T min_delta) {
-	for (T d : deltas) {
-		if (d > min_delta) {
+template <typename T, size_t N>
+std::vector<std::array<T, N>> calculate_means(const std::vector<std::array<T, N>>& data,
+	const std::vector<uint32_t>& clusters,
+	const std::vector<std::array<T, N>>& old_means,
+	uint32_t k) {
+	std::vector<std::array<T, N>> means;
+	std::vector<T> count;
+	calculate_means(data, clusters, old_means, k, means, count);
+	return means;
+}
+
+template <typename T, size_t N>
+bool deltas_below_limit(
+	const std::vector<std::array<T, N>>& old_means, const std::vector<std::array<T, N>>& means, T min_delta) {
+	assert(old_means.size() == means.size());
+	for (size_t i = 0; i < means.size(); ++i) {
+		if (distance(means[i], old_means[i]) > min_delta) {
 			return false;
 		}
 	}
@@ -197,6 +724,13 @@ of optional parameters, including:
   smaller than the specified distance.
 * Random seed; if present, this will be used in place of `std::random_device` for kmeans++
   initialization. This can be used to ensure reproducible/deterministic behavior.
+* Markov chain length; if present, the initial means are chosen with the AFK-MC2 approximation to
+  kmeans++ using chains of this length, rather than exact kmeans++. Around 200 is a good length; longer
+  chains get closer to kmeans++.
+* Deadline and/or time limit; the algorithm will terminate after the first iteration that ends past
+  the deadline, or past the time limit from the start of the call, whichever is sooner. The means are
+  the best found so far. Each iteration is always completed, so the deadline can be overrun by the
+  time of one iteration (and seeding).
 */
 template <typename T>
 class clustering_parameters {
@@ -205,7 +739,10 @@ public:
 	_k(k),
 	_has_max_iter(false), _max_iter(),
 	_has_min_delta(false), _min_delta(),
-	_has_rand_seed(false), _rand_seed()
+	_has_rand_seed(false), _rand_seed(),
+	_has_chain_length(false), _chain_length(),
+	_has_deadline(false), _deadline(),
+	_has_time_limit(false), _time_limit()
 	{}
 
 	void set_max_iteration(uint64_t max_iter)
@@ -226,14 +763,38 @@ public:
 		_has_rand_seed = true;
 	}
 
+	void set_markov_chain_length(uint32_t chain_length)
+	{
+		_chain_length = chain_length;
+		_has_chain_length = true;
+	}
+
+	void set_deadline(std::chrono::steady_clock::time_point deadline)
+	{
+		_deadline = deadline;
+		_has_deadline = true;
+	}
+
+	void set_time_limit(std::chrono::steady_clock::duration time_limit)
+	{
+		_time_limit = time_limit;
+		_has_time_limit = true;
+	}
+
 	bool has_max_iteration() const { return _has_max_iter; }
 	bool has_min_delta() const { return _has_min_delta; }
 	bool has_random_seed() const { return _has_rand_seed; }
+	bool has_markov_chain_length() const { return _has_chain_length; }
+	bool has_deadline() const { return _has_deadline; }
+	bool has_time_limit() const { return _has_time_limit; }
 
 	uint32_t get_k() const { return _k; };
 	uint64_t get_max_iteration() const { return _max_iter; }
 	T get_min_delta() const { return _min_delta; }
 	uint64_t get_random_seed() const { return _rand_seed; }
+	uint32_t get_markov_chain_length() const { return _chain_length; }
+	std::chrono::steady_clock::time_point get_deadline() const { return _deadline; }
+	std::chrono::steady_clock::duration get_time_limit() const { return _time_limit; }
 
 private:
 	uint32_t _k;
@@ -243,8 +804,182 @@ private:
 	T _min_delta;
 	bool _has_rand_seed;
 	uint64_t _rand_seed;
+	bool _has_chain_length;
+	uint32_t _chain_length;
+	bool _has_deadline;
+	std::chrono::steady_clock::time_point _deadline;
+	bool _has_time_limit;
+	std::chrono::steady_clock::duration _time_limit;
+};
+
+/*
+Why an iterative clustering stopped:
+* converged; the means didn't change in the last iteration.
+* cycled; the means returned to where they were two iterations before.
+* min_delta; no mean moved further than the minimum delta.
+* max_iteration; the maximum iteration count was reached.
+* deadline; the deadline or time limit passed.
+*/
+enum class convergence_reason {
+	converged,
+	cycled,
+	min_delta,
+	max_iteration,
+	deadline
+};
+
+/*
+clustering_stats describes a finished clustering, for callers that want to budget their time:
+* iterations; the number of times the means were updated after seeding.
+* inertia; the sum of squared distances from each point to the returned mean of its cluster (weighted
+  by the point weights, for weighted clustering).
+* reason; why the iterations stopped.
+* elapsed; the wall-clock time of the whole call, including seeding.
+*/
+struct clustering_stats {
+	uint64_t iterations;
+	double inertia;
+	convergence_reason reason;
+	std::chrono::steady_clock::duration elapsed;
+};
+
+namespace details {
+
+/*
+Running per-cluster sums are accumulated in double precision for floating point data, so that
+repeatedly adding and removing points doesn't drift the sums away from the points actually in each
+cluster.
+*/
+template <typename T>
+using accumulator = typename std::conditional<std::is_floating_point<T>::value, double, T>::type;
+
+} // namespace details
+
+/*
+kmeans_workspace owns the scratch buffers used by kmeans_lloyd. Passing the same workspace, means and
+labels to repeated calls reuses their storage, so once it has grown to the largest data set and k
+seen, clustering makes no further heap allocations.
+
+The buffers are implementation details and shouldn't be referenced outside of this file.
+*/
+template <typename T, size_t N>
+struct kmeans_workspace {
+	details::cluster_assigner<T, N> assigner;
+	std::vector<std::array<T, N>> old_means;
+	std::vector<std::array<T, N>> old_old_means;
+	std::vector<T> counts;
+	std::vector<T> distances;
+	std::vector<double> proposal;
+	// used by the bounded (Hamerly and Elkan) variants only
+	std::vector<std::array<details::accumulator<T>, N>> sums;
+	std::vector<T> upper_bounds;
+	std::vector<T> lower_bounds;
+	std::vector<T> mean_shifts;
+	std::vector<T> mean_separations;
 };
 
+namespace details {
+
+/*
+Choose the initial means with kmeans++, or with AFK-MC2 if the parameters ask for it.
+*/
+template <typename T, size_t N>
+void seed_means(const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters,
+	kmeans_workspace<T, N>& workspace, std::vector<std::array<T, N>>& means) {
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	uint64_t seed = parameters.get_random_seed();
+	if (!parameters.has_random_seed()) {
+		std::random_device rand_device;
+		seed = rand_device();
+	}
+	if (parameters.has_markov_chain_length() && parameters.get_markov_chain_length() > 0) {
+		random_afk_mc2(data, parameters.get_k(), parameters.get_markov_chain_length(), seed, means, workspace.proposal);
+	} else {
+		random_plusplus(data, parameters.get_k(), seed, means, workspace.distances);
+	}
+}
+
+/*
+The time by which clustering that started at `start` should stop, which is the far future if the
+parameters set no deadline or time limit.
+*/
+template <typename T>
+std::chrono::steady_clock::time_point deadline(const clustering_parameters<T>& parameters,
+	std::chrono::steady_clock::time_point start) {
+	auto deadline = std::chrono::steady_clock::time_point::max();
+	if (parameters.has_deadline()) {
+		deadline = parameters.get_deadline();
+	}
+	if (parameters.has_time_limit() && parameters.get_time_limit() < deadline - start) {
+		deadline = start + parameters.get_time_limit();
+	}
+	return deadline;
+}
+
+/*
+The termination test of kmeans_lloyd, made after `iterations` updates of the means. When it returns
+false, `reason` says why.
+*/
+template <typename T, size_t N>
+bool keep_iterating(const clustering_parameters<T>& parameters, uint64_t iterations,
+	const std::vector<std::array<T, N>>& means,
+	const std::vector<std::array<T, N>>& old_means,
+	const std::vector<std::array<T, N>>& old_old_means,
+	std::chrono::steady_clock::time_point deadline,
+	convergence_reason& reason) {
+	if (means == old_means) {
+		reason = convergence_reason::converged;
+	} else if (means == old_old_means) {
+		reason = convergence_reason::cycled;
+	} else if (parameters.has_min_delta() && deltas_below_limit(old_means, means, parameters.get_min_delta())) {
+		reason = convergence_reason::min_delta;
+	} else if (parameters.has_max_iteration() && iterations == parameters.get_max_iteration()) {
+		reason = convergence_reason::max_iteration;
+	} else if (deadline != std::chrono::steady_clock::time_point::max()
+		&& std::chrono::steady_clock::now() >= deadline) {
+		reason = convergence_reason::deadline;
+	} else {
+		return true;
+	}
+	return false;
+}
+
+/*
+The sum of squared distances from each data point to the mean of its cluster.
+*/
+template <typename T, size_t N>
+double inertia(const std::vector<std::array<T, N>>& data, const std::vector<uint32_t>& clusters,
+	const std::vector<std::array<T, N>>& means) {
+	double sum = 0.0;
+	for (size_t i = 0; i < std::min(data.size(), clusters.size()); ++i) {
+		sum += static_cast<double>(distance_squared(data[i], means[clusters[i]]));
+	}
+	return sum;
+}
+
+template <typename T, size_t N>
+double inertia(const std::vector<std::array<T, N>>& data, const std::vector<T>& weights,
+	const std::vector<uint32_t>& clusters, const std::vector<std::array<T, N>>& means) {
+	double sum = 0.0;
+	for (size_t i = 0; i < std::min(data.size(), clusters.size()); ++i) {
+		sum += static_cast<double>(weights[i]) * static_cast<double>(distance_squared(data[i], means[clusters[i]]));
+	}
+	return sum;
+}
+
+inline clustering_stats make_stats(uint64_t iterations, double inertia, convergence_reason reason,
+	std::chrono::steady_clock::time_point start) {
+	clustering_stats stats;
+	stats.iterations = iterations;
+	stats.inertia = inertia;
+	stats.reason = reason;
+	stats.elapsed = std::chrono::steady_clock::now() - start;
+	return stats;
+}
+
+} // namespace details
+
 /*
 Implementation of k-means generic across the data type and the dimension of each data item. Expects
 the data to be a vector of fixed-size arrays. Generic parameters are the type of the base data (T)
@@ -256,44 +991,120 @@ Takes a `clustering_parameters` struct for algorithm configuration. See the comm
 `clustering_parameters` struct for more information about the configuration values and how they
 affect the algorithm.
 
-Returns a std::tuple containing:
-  0: A vector holding the means for each cluster from 0 to k-1.
-  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
-	 data vector.
+This overload writes its results into caller-owned storage, using `workspace` for everything else:
+  means: The means for each cluster from 0 to k-1.
+  clusters: The cluster number (0 to k-1) for each corresponding element of the input data vector.
+and returns `clustering_stats` describing how the clustering went.
 
 Implementation details:
 This implementation of k-means uses [Lloyd's Algorithm](https://en.wikipedia.org/wiki/Lloyd%27s_algorithm)
-with the [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B)
+with the [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B) (or optionally AFK-MC2)
 used for initializing the means.
 
 */
 template <typename T, size_t N>
-std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
-	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+clustering_stats kmeans_lloyd(const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters,
+	kmeans_workspace<T, N>& workspace, std::vector<std::array<T, N>>& means, std::vector<uint32_t>& clusters) {
 	static_assert(std::is_arithmetic<T>::value && std::is_signed<T>::value,
 		"kmeans_lloyd requires the template parameter T to be a signed arithmetic type (e.g. float, double, int)");
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = details::deadline(parameters, start);
+	details::seed_means(data, parameters, workspace, means);
+
+	auto& old_means = workspace.old_means;
+	auto& old_old_means = workspace.old_old_means;
+	old_means.clear();
+	old_old_means.clear();
+	workspace.assigner.load(data);
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	uint64_t count = 0;
+	convergence_reason reason;
+	do {
+		workspace.assigner.assign(means, clusters);
+		std::swap(old_old_means, old_means);
+		old_means = means;
+		details::calculate_means(data, clusters, old_means, parameters.get_k(), means, workspace.counts);
+		++count;
+	} while (details::keep_iterating(parameters, count, means, old_means, old_old_means, deadline, reason));
+	return details::make_stats(count, details::inertia(data, clusters, means), reason, start);
+}
+
+/*
+Implementation of k-means generic across the data type and the dimension of each data item, as above.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector.
+*/
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+	kmeans_workspace<T, N> workspace;
+	std::vector<std::array<T, N>> means;
+	std::vector<uint32_t> clusters;
+	kmeans_lloyd(data, parameters, workspace, means, clusters);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(std::move(means), std::move(clusters));
+}
+
+/*
+Weighted k-means, where each data point counts `weights[i]` times (weights must be non-negative).
+Otherwise the same as kmeans_lloyd above, except that the initial means are always chosen with
+weighted kmeans++, ignoring any Markov chain length in the parameters. This is meant for clustering a
+summary of a larger data set, such as a grid_coreset, so the data is expected to be small.
+*/
+template <typename T, size_t N>
+clustering_stats kmeans_lloyd(const std::vector<std::array<T, N>>& data, const std::vector<T>& weights,
+	const clustering_parameters<T>& parameters, kmeans_workspace<T, N>& workspace,
+	std::vector<std::array<T, N>>& means, std::vector<uint32_t>& clusters) {
+	static_assert(std::is_floating_point<T>::value,
+		"weighted kmeans_lloyd requires the template parameter T to be a floating point type (e.g. float, double)");
 	assert(parameters.get_k() > 0); // k must be greater than zero
 	assert(data.size() >= parameters.get_k()); // there must be at least k data points
-	std::random_device rand_device;
-	uint64_t seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
-	std::vector<std::array<T, N>> means = details::random_plusplus(data, parameters.get_k(), seed);
+	assert(weights.size() == data.size()); // there must be a weight for each data point
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = details::deadline(parameters, start);
+	uint64_t seed = parameters.get_random_seed();
+	if (!parameters.has_random_seed()) {
+		std::random_device rand_device;
+		seed = rand_device();
+	}
+	details::random_plusplus(data, weights, parameters.get_k(), seed, means, workspace.distances);
 
-	std::vector<std::array<T, N>> old_means;
-	std::vector<std::array<T, N>> old_old_means;
-	std::vector<uint32_t> clusters;
-	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	auto& old_means = workspace.old_means;
+	auto& old_old_means = workspace.old_old_means;
+	old_means.clear();
+	old_old_means.clear();
+	workspace.assigner.load(data);
 	uint64_t count = 0;
+	convergence_reason reason;
 	do {
-		clusters = details::calculate_clusters(data, means);
-		old_old_means = old_means;
+		workspace.assigner.assign(means, clusters);
+		std::swap(old_old_means, old_means);
 		old_means = means;
-		means = details::calculate_means(data, clusters, old_means, parameters.get_k());
+		details::calculate_means(data, weights, clusters, old_means, parameters.get_k(), means, workspace.counts);
 		++count;
-	} while (means != old_means && means != old_old_means
-		&& !(parameters.has_max_iteration() && count == parameters.get_max_iteration())
-		&& !(parameters.has_min_delta() && details::deltas_below_limit(details::deltas(old_means, means), parameters.get_min_delta())));
+	} while (details::keep_iterating(parameters, count, means, old_means, old_old_means, deadline, reason));
+	return details::make_stats(count, details::inertia(data, weights, clusters, means), reason, start);
+}
+
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
+	const std::vector<std::array<T, N>>& data, const std::vector<T>& weights, const clustering_parameters<T>& parameters) {
+	kmeans_workspace<T, N> workspace;
+	std::vector<std::array<T, N>> means;
+	std::vector<uint32_t> clusters;
+	kmeans_lloyd(data, weights, parameters, workspace, means, clusters);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(std::move(means), std::move(clusters));
+}
 
-	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
+/*
+Find the index of the mean closest to `value`, e.g. to label a new point against the means from a
+previous clustering.
+*/
+template <typename T, size_t N>
+uint32_t predict(const std::vector<std::array<T, N>>& means, const std::array<T, N>& value) {
+	return details::closest_mean(value, means);
 }
 
 /*
@@ -315,6 +1126,500 @@ std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
 	return kmeans_lloyd(data, parameters);
 }
 
+/*
+These functions are all private implementation details and shouldn't be referenced outside of this
+file.
+*/
+namespace details {
+
+/*
+Find the closest mean to a point along with the distances to the closest and second closest means.
+Ties go to the lower mean index, as in closest_mean.
+*/
+template <typename T, size_t N>
+void two_closest_means(const std::array<T, N>& point, const std::vector<std::array<T, N>>& means,
+	uint32_t& closest, T& closest_distance, T& second_distance) {
+	T smallest = distance_squared(point, means[0]);
+	T second = std::numeric_limits<T>::max();
+	closest = 0;
+	for (uint32_t i = 1; i < means.size(); ++i) {
+		T d_squared = distance_squared(point, means[i]);
+		if (d_squared < smallest) {
+			second = smallest;
+			smallest = d_squared;
+			closest = i;
+		} else if (d_squared < second) {
+			second = d_squared;
+		}
+	}
+	closest_distance = std::sqrt(smallest);
+	second_distance = second == std::numeric_limits<T>::max() ? second : std::sqrt(second);
+}
+
+template <typename T, size_t N>
+void move_between_sums(const std::array<T, N>& point, uint32_t from, uint32_t to,
+	std::vector<std::array<accumulator<T>, N>>& sums, std::vector<T>& counts) {
+	counts[from] -= 1;
+	counts[to] += 1;
+	for (size_t j = 0; j < N; ++j) {
+		sums[from][j] -= point[j];
+		sums[to][j] += point[j];
+	}
+}
+
+/*
+Recalculate the means from the running per-cluster sums, keeping the old mean of an empty cluster as
+calculate_means does, and record how far each mean moved.
+*/
+template <typename T, size_t N>
+void means_from_sums(const std::vector<std::array<accumulator<T>, N>>& sums, const std::vector<T>& counts,
+	const std::vector<std::array<T, N>>& old_means,
+	std::vector<std::array<T, N>>& means, std::vector<T>& shifts) {
+	shifts.resize(means.size());
+	for (size_t i = 0; i < means.size(); ++i) {
+		if (counts[i] > 0) {
+			for (size_t j = 0; j < N; ++j) {
+				means[i][j] = static_cast<T>(sums[i][j] / static_cast<accumulator<T>>(counts[i]));
+			}
+		}
+		shifts[i] = distance(means[i], old_means[i]);
+	}
+}
+
+/*
+Half the distance between every pair of means (k x k, row-major) and, for each mean, half the distance
+to its nearest other mean. A point closer to its mean than either of these can't be closer to the
+other mean(s) concerned.
+*/
+template <typename T, size_t N>
+void mean_separations(const std::vector<std::array<T, N>>& means,
+	std::vector<T>& pairwise, std::vector<T>& nearest) {
+	const size_t k = means.size();
+	pairwise.resize(k * k);
+	nearest.assign(k, std::numeric_limits<T>::max());
+	for (size_t a = 0; a < k; ++a) {
+		pairwise[a * k + a] = T();
+		for (size_t b = a + 1; b < k; ++b) {
+			T half = distance(means[a], means[b]) / 2;
+			pairwise[a * k + b] = half;
+			pairwise[b * k + a] = half;
+			nearest[a] = std::min(nearest[a], half);
+			nearest[b] = std::min(nearest[b], half);
+		}
+	}
+}
+
+} // namespace details
+
+/*
+Implementation of k-means using [Hamerly's algorithm](https://doi.org/10.1137/1.9781611972801.12),
+with the same parameters and results as kmeans_lloyd.
+
+Each point keeps an upper bound on the distance to its own mean and a single lower bound on the
+distance to any other mean. Bounds are loosened by how far the means move each iteration, and a point
+whose upper bound is still below both its lower bound and half the distance from its mean to the
+nearest other mean can't change cluster, so it is skipped without computing any distances. In the
+late iterations, where few points move, most of the work of Lloyd's algorithm is skipped.
+
+The means are seeded, and the iterations terminate, exactly as in kmeans_lloyd, so results are the
+same apart from floating point rounding between near-equal distances. T must be a floating point type.
+*/
+template <typename T, size_t N>
+clustering_stats kmeans_hamerly(const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters,
+	kmeans_workspace<T, N>& workspace, std::vector<std::array<T, N>>& means, std::vector<uint32_t>& clusters) {
+	static_assert(std::is_floating_point<T>::value,
+		"kmeans_hamerly requires the template parameter T to be a floating point type (e.g. float, double)");
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = details::deadline(parameters, start);
+	const uint32_t k = parameters.get_k();
+	details::seed_means(data, parameters, workspace, means);
+
+	auto& upper = workspace.upper_bounds;
+	auto& lower = workspace.lower_bounds;
+	auto& sums = workspace.sums;
+	auto& counts = workspace.counts;
+	upper.resize(data.size());
+	lower.resize(data.size());
+	clusters.resize(data.size());
+	sums.assign(k, std::array<details::accumulator<T>, N>());
+	counts.assign(k, T());
+	// The first assignment compares every point with every mean
+	for (size_t i = 0; i < data.size(); ++i) {
+		details::two_closest_means(data[i], means, clusters[i], upper[i], lower[i]);
+		counts[clusters[i]] += 1;
+		for (size_t j = 0; j < N; ++j) {
+			sums[clusters[i]][j] += data[i][j];
+		}
+	}
+
+	auto& old_means = workspace.old_means;
+	auto& old_old_means = workspace.old_old_means;
+	old_means.clear();
+	old_old_means.clear();
+	uint64_t count = 0;
+	convergence_reason reason;
+	for (;;) {
+		std::swap(old_old_means, old_means);
+		old_means = means;
+		details::means_from_sums(sums, counts, old_means, means, workspace.mean_shifts);
+		++count;
+		if (!details::keep_iterating(parameters, count, means, old_means, old_old_means, deadline, reason)) break;
+
+		// Another mean can have come no closer than the largest shift, or the second largest if the
+		// largest was the point's own mean
+		const auto& shifts = workspace.mean_shifts;
+		uint32_t furthest = static_cast<uint32_t>(std::max_element(shifts.begin(), shifts.end()) - shifts.begin());
+		T second_shift = T();
+		for (uint32_t j = 0; j < k; ++j) {
+			if (j != furthest) second_shift = std::max(second_shift, shifts[j]);
+		}
+		details::mean_separations(means, workspace.distances, workspace.mean_separations);
+		const auto& separations = workspace.mean_separations;
+
+		for (size_t i = 0; i < data.size(); ++i) {
+			uint32_t cluster = clusters[i];
+			upper[i] += shifts[cluster];
+			lower[i] -= cluster == furthest ? second_shift : shifts[furthest];
+			T bound = std::max(separations[cluster], lower[i]);
+			if (upper[i] < bound) continue;
+			upper[i] = details::distance(data[i], means[cluster]);
+			if (upper[i] < bound) continue;
+			uint32_t closest;
+			details::two_closest_means(data[i], means, closest, upper[i], lower[i]);
+			if (closest != cluster) {
+				details::move_between_sums(data[i], cluster, closest, sums, counts);
+				clusters[i] = closest;
+			}
+		}
+	}
+	return details::make_stats(count, details::inertia(data, clusters, means), reason, start);
+}
+
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_hamerly(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+	kmeans_workspace<T, N> workspace;
+	std::vector<std::array<T, N>> means;
+	std::vector<uint32_t> clusters;
+	kmeans_hamerly(data, parameters, workspace, means, clusters);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(std::move(means), std::move(clusters));
+}
+
+/*
+Implementation of k-means using [Elkan's algorithm](https://cdn.aaai.org/ICML/2003/ICML03-022.pdf),
+with the same parameters and results as kmeans_lloyd.
+
+Like kmeans_hamerly, but each point keeps a separate lower bound for every mean, and the distances
+between means are used to rule out individual means. This skips more distance calculations than
+Hamerly's algorithm at the cost of n x k bounds to maintain, which only pays off when distances are
+expensive, i.e. for higher dimensional data.
+
+The means are seeded, and the iterations terminate, exactly as in kmeans_lloyd, so results are the
+same apart from floating point rounding between near-equal distances. T must be a floating point type.
+*/
+template <typename T, size_t N>
+clustering_stats kmeans_elkan(const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters,
+	kmeans_workspace<T, N>& workspace, std::vector<std::array<T, N>>& means, std::vector<uint32_t>& clusters) {
+	static_assert(std::is_floating_point<T>::value,
+		"kmeans_elkan requires the template parameter T to be a floating point type (e.g. float, double)");
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = details::deadline(parameters, start);
+	const uint32_t k = parameters.get_k();
+	details::seed_means(data, parameters, workspace, means);
+
+	auto& upper = workspace.upper_bounds;
+	auto& lower = workspace.lower_bounds;
+	auto& sums = workspace.sums;
+	auto& counts = workspace.counts;
+	upper.resize(data.size());
+	lower.resize(data.size() * k);
+	clusters.resize(data.size());
+	sums.assign(k, std::array<details::accumulator<T>, N>());
+	counts.assign(k, T());
+	// The first assignment compares every point with every mean
+	for (size_t i = 0; i < data.size(); ++i) {
+		T* point_lower = &lower[i * k];
+		uint32_t closest = 0;
+		for (uint32_t j = 0; j < k; ++j) {
+			point_lower[j] = details::distance(data[i], means[j]);
+			if (point_lower[j] < point_lower[closest]) closest = j;
+		}
+		clusters[i] = closest;
+		upper[i] = point_lower[closest];
+		counts[closest] += 1;
+		for (size_t j = 0; j < N; ++j) {
+			sums[closest][j] += data[i][j];
+		}
+	}
+
+	auto& old_means = workspace.old_means;
+	auto& old_old_means = workspace.old_old_means;
+	old_means.clear();
+	old_old_means.clear();
+	uint64_t count = 0;
+	convergence_reason reason;
+	for (;;) {
+		std::swap(old_old_means, old_means);
+		old_means = means;
+		details::means_from_sums(sums, counts, old_means, means, workspace.mean_shifts);
+		++count;
+		if (!details::keep_iterating(parameters, count, means, old_means, old_old_means, deadline, reason)) break;
+
+		const auto& shifts = workspace.mean_shifts;
+		details::mean_separations(means, workspace.distances, workspace.mean_separations);
+		const auto& half_distances = workspace.distances;
+		const auto& separations = workspace.mean_separations;
+
+		for (size_t i = 0; i < data.size(); ++i) {
+			T* point_lower = &lower[i * k];
+			for (uint32_t j = 0; j < k; ++j) {
+				point_lower[j] = std::max(T(), point_lower[j] - shifts[j]);
+			}
+			uint32_t cluster = clusters[i];
+			upper[i] += shifts[cluster];
+			if (upper[i] < separations[cluster]) continue;
+
+			uint32_t closest = cluster;
+			bool upper_is_exact = false;
+			for (uint32_t j = 0; j < k; ++j) {
+				if (j == closest) continue;
+				if (upper[i] < point_lower[j] || upper[i] < half_distances[closest * k + j]) continue;
+				if (!upper_is_exact) {
+					upper[i] = details::distance(data[i], means[closest]);
+					point_lower[closest] = upper[i];
+					upper_is_exact = true;
+					if (upper[i] < point_lower[j] || upper[i] < half_distances[closest * k + j]) continue;
+				}
+				T d = details::distance(data[i], means[j]);
+				point_lower[j] = d;
+				// ties go to the lower mean index, as in closest_mean
+				if (d < upper[i] || (d == upper[i] && j < closest)) {
+					closest = j;
+					upper[i] = d;
+				}
+			}
+			if (closest != cluster) {
+				details::move_between_sums(data[i], cluster, closest, sums, counts);
+				clusters[i] = closest;
+			}
+		}
+	}
+	return details::make_stats(count, details::inertia(data, clusters, means), reason, start);
+}
+
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_elkan(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+	kmeans_workspace<T, N> workspace;
+	std::vector<std::array<T, N>> means;
+	std::vector<uint32_t> clusters;
+	kmeans_elkan(data, parameters, workspace, means, clusters);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(std::move(means), std::move(clusters));
+}
+
+/*
+kmeans_streaming is a stateful k-means clusterer for a sliding window of data that changes a little
+at a time, such as the most recent n samples of a stream.
+
+Rather than re-running kmeans_lloyd over the whole window whenever it changes, the window is seeded
+once with kmeans_lloyd and then maintained incrementally from the previous means:
+* `insert` assigns a new point to its closest mean and folds it into that cluster's running sums.
+* `erase` removes a point that has left the window from its cluster's running sums.
+* `refine` re-assigns a bounded number of points from the window against the current means, moving
+  them between clusters as needed. Successive calls walk round the whole window, so repeated calls
+  perform Lloyd iterations spread across several updates.
+
+Means are always the exact centroids of the points currently assigned to them. The caller owns the
+window and the labels, which must be kept index-aligned with each other; points are expected to
+leave the window from the front (oldest first), which keeps the `refine` cursor in place.
+*/
+template <typename T, size_t N>
+class kmeans_streaming {
+public:
+	explicit kmeans_streaming(const clustering_parameters<T>& parameters) :
+	_parameters(parameters),
+	_refine_cursor(0)
+	{}
+
+	/*
+	Cold start: cluster the whole window with kmeans_lloyd, replacing any previous state, and write
+	the cluster assignment of each point into `labels`.
+	*/
+	template <typename Labels>
+	clustering_stats seed(const std::vector<std::array<T, N>>& data, Labels& labels) {
+		clustering_stats stats = kmeans_lloyd(data, _parameters, _workspace, _means, _seed_labels);
+		adopt(data, labels);
+		return stats;
+	}
+
+	/*
+	Cold start with another clustering engine, called as `engine(data, parameters)` and returning the
+	same (means, labels) tuple as kmeans_lloyd.
+	*/
+	template <typename Labels, typename Engine>
+	void seed(const std::vector<std::array<T, N>>& data, Labels& labels, Engine&& engine) {
+		auto results = engine(data, _parameters);
+		_means = std::move(std::get<0>(results));
+		_seed_labels = std::move(std::get<1>(results));
+		adopt(data, labels);
+	}
+
+	bool is_seeded() const { return !_means.empty(); }
+
+	void reset() {
+		_means.clear();
+		_sums.clear();
+		_counts.clear();
+		_refine_cursor = 0;
+	}
+
+	/*
+	Add a point that has just joined the window, returning the cluster it was assigned to.
+	*/
+	uint32_t insert(const std::array<T, N>& point) {
+		assert(is_seeded());
+		uint32_t label = details::closest_mean(point, _means);
+		add_to_cluster(point, label);
+		update_mean(label);
+		return label;
+	}
+
+	/*
+	Remove a point, with the label it was last assigned, that has left the front of the window.
+	*/
+	void erase(const std::array<T, N>& point, uint32_t label) {
+		assert(is_seeded() && label < _means.size());
+		remove_from_cluster(point, label);
+		update_mean(label);
+		if (_refine_cursor > 0) --_refine_cursor;
+	}
+
+	/*
+	Re-assign up to `max_points` points of the window, continuing from where the previous call left
+	off, and return how many labels changed. The batch is assigned against the means as they were at
+	the start of the call. A cluster left empty is moved onto the refined point that was furthest from
+	its mean, so means can't be stranded away from the data as the window moves on.
+	*/
+	template <typename Points, typename Labels>
+	size_t refine(const Points& data, Labels& labels, size_t max_points) {
+		return refine(data, labels, max_points, [](size_t, uint32_t, uint32_t) {});
+	}
+
+	/*
+	As above, calling `moved(index, from, to)` for each point whose label changes.
+	*/
+	template <typename Points, typename Labels, typename Moved>
+	size_t refine(const Points& data, Labels& labels, size_t max_points, Moved&& moved) {
+		assert(is_seeded());
+		assert(data.size() == labels.size());
+		if (data.size() == 0 || max_points == 0) return 0;
+		max_points = std::min<size_t>(max_points, data.size());
+		if (_refine_cursor >= data.size()) _refine_cursor = 0;
+		size_t first = _refine_cursor;
+		_batch.resize(max_points);
+		for (size_t n = 0; n < max_points; ++n) {
+			_batch[n] = data[(first + n) % data.size()];
+		}
+		_refine_cursor = (first + max_points) % data.size();
+		_assigner.load(_batch);
+		_assigner.assign(_means, _batch_labels);
+
+		size_t changed = 0;
+		size_t furthest = 0;
+		T furthest_distance = T(-1);
+		for (size_t n = 0; n < max_points; ++n) {
+			size_t i = (first + n) % data.size();
+			uint32_t label = _batch_labels[n];
+			if (label != labels[i]) {
+				move_point(_batch[n], labels[i], label);
+				moved(i, labels[i], label);
+				labels[i] = label;
+				++changed;
+			}
+			T distance = details::distance_squared(_batch[n], _means[label]);
+			if (distance > furthest_distance) {
+				furthest_distance = distance;
+				furthest = n;
+			}
+		}
+		size_t furthest_index = (first + furthest) % data.size();
+		for (uint32_t cluster = 0; cluster < _means.size(); ++cluster) {
+			if (_counts[cluster] > 0 || _counts[labels[furthest_index]] < 2) continue;
+			move_point(_batch[furthest], labels[furthest_index], cluster);
+			moved(furthest_index, labels[furthest_index], cluster);
+			labels[furthest_index] = cluster;
+			++changed;
+			break;
+		}
+		return changed;
+	}
+
+	const std::vector<std::array<T, N>>& means() const { return _means; }
+	const clustering_parameters<T>& parameters() const { return _parameters; }
+
+private:
+	// Take on the means and labels of a cold clustering of the whole window.
+	template <typename Labels>
+	void adopt(const std::vector<std::array<T, N>>& data, Labels& labels) {
+		labels.assign(_seed_labels.begin(), _seed_labels.end());
+		_sums.assign(_means.size(), std::array<sum_type, N>());
+		_counts.assign(_means.size(), 0);
+		for (size_t i = 0; i < data.size(); ++i) {
+			add_to_cluster(data[i], _seed_labels[i]);
+		}
+		for (uint32_t cluster = 0; cluster < _means.size(); ++cluster) {
+			update_mean(cluster);
+		}
+		_refine_cursor = 0;
+	}
+
+	using sum_type = details::accumulator<T>;
+
+	void add_to_cluster(const std::array<T, N>& point, uint32_t cluster) {
+		++_counts[cluster];
+		for (size_t j = 0; j < N; ++j) {
+			_sums[cluster][j] += point[j];
+		}
+	}
+
+	void remove_from_cluster(const std::array<T, N>& point, uint32_t cluster) {
+		assert(_counts[cluster] > 0);
+		--_counts[cluster];
+		for (size_t j = 0; j < N; ++j) {
+			_sums[cluster][j] -= point[j];
+		}
+	}
+
+	void move_point(const std::array<T, N>& point, uint32_t from, uint32_t to) {
+		remove_from_cluster(point, from);
+		add_to_cluster(point, to);
+		update_mean(from);
+		update_mean(to);
+	}
+
+	// An empty cluster keeps its previous mean, as in details::calculate_means.
+	void update_mean(uint32_t cluster) {
+		if (_counts[cluster] == 0) {
+			_sums[cluster] = std::array<sum_type, N>();
+			return;
+		}
+		for (size_t j = 0; j < N; ++j) {
+			_means[cluster][j] = static_cast<T>(_sums[cluster][j] / static_cast<sum_type>(_counts[cluster]));
+		}
+	}
+
+	clustering_parameters<T> _parameters;
+	std::vector<std::array<T, N>> _means;
+	std::vector<std::array<sum_type, N>> _sums;
+	std::vector<uint64_t> _counts;
+	size_t _refine_cursor;
+	std::vector<std::array<T, N>> _batch;
+	std::vector<uint32_t> _batch_labels;
+	details::cluster_assigner<T, N> _assigner;
+	kmeans_workspace<T, N> _workspace;
+	std::vector<uint32_t> _seed_labels;
+};
+
 } // namespace dkm
 
 #endif /* DKM_KMEANS_H */
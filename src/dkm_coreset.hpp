@@ -0,0 +1,133 @@
+#pragma once
+
+// only included in case there's a C++11 compiler out there that doesn't support `#pragma once`
+#ifndef DKM_CORESET_H
+#define DKM_CORESET_H
+
+#include "dkm.hpp"
+
+/*
+DKM - A k-means implementation that is generic across variable data dimensions.
+
+This is a grid coreset: a weighted summary of a data set that can be clustered in place of the data
+itself, with the weighted kmeans_lloyd.
+*/
+namespace dkm {
+
+/*
+grid_coreset buckets points into a fixed grid of cells over [lower, upper] in every dimension (points
+outside are clamped into the edge cells). Each occupied cell becomes one coreset point, at the
+centroid of the points in it, weighted by how many points it holds. Clustering the coreset costs at
+most cells_per_dimension^N points however much data went into it, at the price of every point in a
+cell sharing one label.
+
+After `build`, `points()` and `weights()` are the coreset, and `expand_labels` turns labels for the
+coreset back into labels for each of the original points. Storage is reused between builds.
+*/
+template <typename T, size_t N>
+class grid_coreset {
+public:
+	static_assert(std::is_floating_point<T>::value,
+		"grid_coreset requires the template parameter T to be a floating point type (e.g. float, double)");
+
+	explicit grid_coreset(uint32_t cells_per_dimension, T lower = T(0), T upper = T(1)) :
+	_cells_per_dimension(cells_per_dimension),
+	_lower(lower),
+	_scale(cells_per_dimension / (upper - lower))
+	{
+		assert(cells_per_dimension > 0);
+		assert(upper > lower);
+		size_t cell_count = 1;
+		for (size_t i = 0; i < N; ++i) {
+			cell_count *= cells_per_dimension;
+		}
+		_cells.assign(cell_count, empty_cell);
+	}
+
+	/*
+	Replace the coreset with a summary of `data`, which can be any indexable container of points.
+	*/
+	template <typename Points>
+	void build(const Points& data) {
+		for (size_t cell : _occupied_cells) {
+			_cells[cell] = empty_cell;
+		}
+		_occupied_cells.clear();
+		_sums.clear();
+		_weights.clear();
+		_point_cells.resize(data.size());
+		for (size_t i = 0; i < data.size(); ++i) {
+			const std::array<T, N>& point = data[i];
+			size_t cell = cell_index(point);
+			uint32_t index = _cells[cell];
+			if (index == empty_cell) {
+				index = static_cast<uint32_t>(_occupied_cells.size());
+				_cells[cell] = index;
+				_occupied_cells.push_back(cell);
+				_sums.emplace_back();
+				_weights.push_back(T());
+			}
+			_point_cells[i] = index;
+			_weights[index] += 1;
+			for (size_t j = 0; j < N; ++j) {
+				_sums[index][j] += point[j];
+			}
+		}
+		_points.resize(_sums.size());
+		for (size_t i = 0; i < _sums.size(); ++i) {
+			for (size_t j = 0; j < N; ++j) {
+				_points[i][j] = static_cast<T>(_sums[i][j] / _weights[i]);
+			}
+		}
+	}
+
+	const std::vector<std::array<T, N>>& points() const { return _points; }
+	const std::vector<T>& weights() const { return _weights; }
+	size_t size() const { return _points.size(); }
+	uint32_t cells_per_dimension() const { return _cells_per_dimension; }
+
+	/*
+	Write the label of each point from the last `build` into `labels`, given the label of each coreset
+	point in `coreset_labels`.
+	*/
+	template <typename Labels>
+	void expand_labels(const std::vector<uint32_t>& coreset_labels, Labels& labels) const {
+		assert(coreset_labels.size() == _points.size());
+		labels.resize(_point_cells.size());
+		for (size_t i = 0; i < _point_cells.size(); ++i) {
+			labels[i] = coreset_labels[_point_cells[i]];
+		}
+	}
+
+private:
+	static constexpr uint32_t empty_cell = std::numeric_limits<uint32_t>::max();
+
+	size_t cell_index(const std::array<T, N>& point) const {
+		size_t cell = 0;
+		for (size_t j = 0; j < N; ++j) {
+			T offset = (point[j] - _lower) * _scale;
+			// points below the grid, and NaN, go in the first cell
+			uint32_t c = !(offset > T()) ? 0
+				: offset < _cells_per_dimension ? static_cast<uint32_t>(offset) : _cells_per_dimension - 1;
+			cell = cell * _cells_per_dimension + c;
+		}
+		return cell;
+	}
+
+	uint32_t _cells_per_dimension;
+	T _lower;
+	T _scale;
+	std::vector<uint32_t> _cells; // coreset index of each grid cell, or empty_cell
+	std::vector<size_t> _occupied_cells;
+	std::vector<std::array<details::accumulator<T>, N>> _sums;
+	std::vector<std::array<T, N>> _points;
+	std::vector<T> _weights;
+	std::vector<uint32_t> _point_cells; // coreset index of each point
+};
+
+template <typename T, size_t N>
+constexpr uint32_t grid_coreset<T, N>::empty_cell;
+
+} // namespace dkm
+
+#endif /* DKM_CORESET_H */
@@ -0,0 +1,265 @@
+#pragma once
+
+// only included in case there's a C++11 compiler out there that doesn't support `#pragma once`
+#ifndef DKM_PARALLEL_KMEANS_H
+#define DKM_PARALLEL_KMEANS_H
+
+#include "dkm.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+DKM - A k-means implementation that is generic across variable data dimensions.
+
+This is the multi-threaded variant of kmeans_lloyd, using a small thread pool of its own rather than
+OpenMP so that it can share threads between calls made every frame.
+*/
+namespace dkm {
+
+/*
+thread_pool is a fixed set of worker threads that run the tasks of one `parallel_for` at a time. The
+calling thread also takes tasks, so a pool of size 1 has no worker threads and runs everything inline.
+*/
+class thread_pool {
+public:
+	explicit thread_pool(size_t threads = std::thread::hardware_concurrency()) :
+	_task(nullptr), _task_count(0), _next_task(0), _pending_tasks(0), _stopping(false)
+	{
+		for (size_t i = 1; i < threads; ++i) {
+			_workers.emplace_back([this] { work(); });
+		}
+	}
+
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_work_available.notify_all();
+		for (auto& worker : _workers) {
+			worker.join();
+		}
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	size_t size() const { return _workers.size() + 1; }
+
+	/*
+	Call `task(i)` for each i in [0, count) across the pool, returning once all of them have finished.
+	*/
+	void parallel_for(size_t count, const std::function<void(size_t)>& task) {
+		if (count == 0) return;
+		if (count == 1 || _workers.empty()) {
+			for (size_t i = 0; i < count; ++i) {
+				task(i);
+			}
+			return;
+		}
+		std::lock_guard<std::mutex> caller_lock(_caller_mutex);
+		std::unique_lock<std::mutex> lock(_mutex);
+		_task = &task;
+		_task_count = count;
+		_next_task = 0;
+		_pending_tasks = count;
+		_work_available.notify_all();
+		while (_next_task < _task_count) {
+			run_next_task(lock);
+		}
+		_work_done.wait(lock, [this] { return _pending_tasks == 0; });
+		_task = nullptr;
+		_task_count = 0;
+	}
+
+private:
+	void work() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		for (;;) {
+			_work_available.wait(lock, [this] { return _stopping || _next_task < _task_count; });
+			if (_stopping) return;
+			run_next_task(lock);
+		}
+	}
+
+	// Tasks are handed out one at a time under the lock, which is cheap next to the size of a task.
+	void run_next_task(std::unique_lock<std::mutex>& lock) {
+		size_t i = _next_task++;
+		const std::function<void(size_t)>* task = _task;
+		lock.unlock();
+		(*task)(i);
+		lock.lock();
+		if (--_pending_tasks == 0) {
+			_work_done.notify_all();
+		}
+	}
+
+	std::vector<std::thread> _workers;
+	std::mutex _caller_mutex;
+	std::mutex _mutex;
+	std::condition_variable _work_available;
+	std::condition_variable _work_done;
+	const std::function<void(size_t)>* _task;
+	size_t _task_count;
+	size_t _next_task;
+	size_t _pending_tasks;
+	bool _stopping;
+};
+
+/*
+These functions are all private implementation details and shouldn't be referenced outside of this
+file.
+*/
+namespace details {
+
+/*
+Data is split into chunks of this many points regardless of the number of threads, and per-chunk
+partial sums are always reduced in chunk order, so results don't depend on the size of the pool.
+Chunks are small enough that the app's note window (around 12k points) makes a dozen tasks, and
+large enough that handing one out costs little next to assigning it.
+*/
+static constexpr size_t parallel_chunk_size = 1024;
+
+/*
+Per-cluster sums and counts for the points of one chunk.
+*/
+template <typename T, size_t N>
+struct partial_means {
+	std::vector<std::array<T, N>> sums;
+	std::vector<T> counts;
+};
+
+} // namespace details
+
+/*
+parallel_kmeans_workspace owns the scratch buffers used by kmeans_lloyd_parallel: those of the serial
+kmeans_workspace, which also holds the seeding state, and the per-chunk partial sums. As with
+kmeans_workspace, passing the same workspace, means and labels to repeated calls reuses their storage,
+so once it has grown to the largest data set and k seen, clustering makes no further heap allocations.
+
+The buffers are implementation details and shouldn't be referenced outside of this file.
+*/
+template <typename T, size_t N>
+struct parallel_kmeans_workspace {
+	kmeans_workspace<T, N> serial;
+	std::vector<details::partial_means<T, N>> partials;
+};
+
+/*
+Multi-threaded implementation of kmeans_lloyd, with the same parameters and results.
+
+Each iteration assigns every chunk of the data to its closest means and accumulates that chunk's
+per-cluster sums and counts in one pass, in parallel across `pool`; the partial sums are then reduced
+into the new means. The kmeans++ (or AFK-MC2) initialization is the same as kmeans_lloyd's, so a fixed
+`set_random_seed` gives the same results for any number of threads. Sums are accumulated per chunk,
+so the means can differ from the serial kmeans_lloyd in the last bits of precision.
+
+Data smaller than one chunk is clustered on the calling thread.
+
+This overload writes its results into `means` and `clusters` and returns `clustering_stats`.
+*/
+template <typename T, size_t N>
+clustering_stats kmeans_lloyd_parallel(const std::vector<std::array<T, N>>& data,
+	const clustering_parameters<T>& parameters, thread_pool& pool, parallel_kmeans_workspace<T, N>& workspace,
+	std::vector<std::array<T, N>>& means, std::vector<uint32_t>& clusters) {
+	static_assert(std::is_arithmetic<T>::value && std::is_signed<T>::value,
+		"kmeans_lloyd_parallel requires the template parameter T to be a signed arithmetic type (e.g. float, double, int)");
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = details::deadline(parameters, start);
+	const uint32_t k = parameters.get_k();
+	details::seed_means(data, parameters, workspace.serial, means);
+
+	const size_t chunk_count = (data.size() + details::parallel_chunk_size - 1) / details::parallel_chunk_size;
+	auto& partials = workspace.partials;
+	if (partials.size() < chunk_count) partials.resize(chunk_count); // only ever grows, keeping each chunk's buffers
+	auto& assigner = workspace.serial.assigner;
+	assigner.load(data);
+
+	auto& old_means = workspace.serial.old_means;
+	auto& old_old_means = workspace.serial.old_old_means;
+	auto& cluster_counts = workspace.serial.counts;
+	old_means.clear();
+	old_old_means.clear();
+	clusters.resize(data.size());
+	// captures a single reference, so the std::function holds it without allocating
+	struct chunk_state {
+		const std::vector<std::array<T, N>>& data;
+		std::vector<details::partial_means<T, N>>& partials;
+		const details::cluster_assigner<T, N>& assigner;
+		std::vector<uint32_t>& clusters;
+		uint32_t k;
+	} state { data, partials, assigner, clusters, k };
+	std::function<void(size_t)> assign_chunk = [&state](size_t chunk) {
+		size_t begin = chunk * details::parallel_chunk_size;
+		size_t end = std::min(begin + details::parallel_chunk_size, state.data.size());
+		auto& partial = state.partials[chunk];
+		partial.sums.assign(state.k, std::array<T, N>());
+		partial.counts.assign(state.k, T());
+		state.assigner.assign_range(begin, end, state.clusters.data());
+		for (size_t i = begin; i < end; ++i) {
+			auto& sum = partial.sums[state.clusters[i]];
+			partial.counts[state.clusters[i]] += 1;
+			for (size_t j = 0; j < N; ++j) {
+				sum[j] += state.data[i][j];
+			}
+		}
+	};
+
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	uint64_t count = 0;
+	convergence_reason reason;
+	do {
+		assigner.prepare(means);
+		pool.parallel_for(chunk_count, assign_chunk);
+		std::swap(old_old_means, old_means);
+		old_means = means;
+		cluster_counts.assign(k, T());
+		means.assign(k, std::array<T, N>());
+		for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+			const auto& partial = partials[chunk];
+			for (uint32_t i = 0; i < k; ++i) {
+				cluster_counts[i] += partial.counts[i];
+				for (size_t j = 0; j < N; ++j) {
+					means[i][j] += partial.sums[i][j];
+				}
+			}
+		}
+		for (uint32_t i = 0; i < k; ++i) {
+			if (cluster_counts[i] == 0) {
+				means[i] = old_means[i];
+			} else {
+				for (size_t j = 0; j < N; ++j) {
+					means[i][j] /= cluster_counts[i];
+				}
+			}
+		}
+		++count;
+	} while (details::keep_iterating(parameters, count, means, old_means, old_old_means, deadline, reason));
+	return details::make_stats(count, details::inertia(data, clusters, means), reason, start);
+}
+
+template <typename T, size_t N>
+clustering_stats kmeans_lloyd_parallel(const std::vector<std::array<T, N>>& data,
+	const clustering_parameters<T>& parameters, thread_pool& pool,
+	std::vector<std::array<T, N>>& means, std::vector<uint32_t>& clusters) {
+	parallel_kmeans_workspace<T, N> workspace;
+	return kmeans_lloyd_parallel(data, parameters, pool, workspace, means, clusters);
+}
+
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd_parallel(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters, thread_pool& pool) {
+	std::vector<std::array<T, N>> means;
+	std::vector<uint32_t> clusters;
+	kmeans_lloyd_parallel(data, parameters, pool, means, clusters);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(std::move(means), std::move(clusters));
+}
+
+} // namespace dkm
+
+#endif /* DKM_PARALLEL_KMEANS_H */
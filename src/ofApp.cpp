@@ -1,6 +1,5 @@
 #include "ofApp.h"
 #include "ofxTimeMeasurements.h"
-#include "dkm.hpp"
 
 //--------------------------------------------------------------
 void ofApp::setupSom() {
@@ -11,7 +10,9 @@ void ofApp::setupSom() {
   som.setMapSize(Constants::SOM_WIDTH, Constants::SOM_HEIGHT); // can go to 3 dimensions
   som.setInitialLearningRate(0.1);
   som.setNumIterations(3000);
+  som.setRandomSeed(1000);
   som.setup();
+  somColors.update(som);
 }
 
 void ofApp::setup(){
@@ -36,23 +37,15 @@ void ofApp::setup(){
   audioDataSpectrumPlotsPtr = std::make_shared<ofxAudioData::SpectrumPlots>(audioDataProcessorPtr);
   
   fadeShader.load();
+  ditheredFadeShader.load();
   translateShader.load();
   logisticFnShader.load();
 
   fluidSimulation.setup({ Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT });
-  
-  divisionsFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGBA);
-  divisionsFbo.getSource().clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
-  
-  foregroundFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGBA32F);
-  foregroundFbo.getSource().clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
-  
-  crystalFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGBA32F);
-  crystalFbo.getSource().clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
-  crystalMaskFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_R8);
-  maskShader.load();
-  
-  compositeFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGB);
+  allocateFbos();
+
+  noteHistory.setup(clusterSourceSamplesMaxParameter.getMax());
+  clusterMembers.setup(sampleNotesParameter.getMax());
 
   setupSom();
   somImage.allocate(Constants::SOM_WIDTH, Constants::SOM_HEIGHT, OF_IMAGE_COLOR);
@@ -72,18 +65,37 @@ void ofApp::setup(){
 
   clusterParameters.add(clusterCentresParameter);
   clusterParameters.add(clusterSourceSamplesMaxParameter);
+  clusterParameters.add(clusterRefineSamplesParameter);
+  clusterParameters.add(clusterCoresetParameter);
+  clusterParameters.add(clusterCoresetCellsParameter);
+  clusterParameters.add(clusterTimeLimitParameter);
+  clusterParameters.add(clusterAsyncParameter);
   clusterParameters.add(clusterDecayRateParameter);
   clusterParameters.add(sameClusterToleranceParameter);
   parameters.add(clusterParameters);
   
   crystalParameters.add(sampleNotesParameter);
+  crystalParameters.add(crystalsPerNoteParameter);
+  crystalParameters.add(frozenFluidIntervalParameter);
   parameters.add(crystalParameters);
   
+  connectionParameters.add(connectionsLayerParameter);
+  parameters.add(connectionParameters);
+
   fadeParameters.add(fadeCrystalsParameter);
   fadeParameters.add(fadeDivisionsParameter);
   fadeParameters.add(fadeForegroundParameter);
   parameters.add(fadeParameters);
   
+  somParameters.add(somApproximateBmuParameter);
+  somParameters.add(somExactFallbackRateParameter);
+  somParameters.add(somColorBilinearParameter);
+  parameters.add(somParameters);
+
+  snapshotParameters.add(snapshotFormatParameter);
+  snapshotParameters.add(snapshotPngLevelParameter);
+  parameters.add(snapshotParameters);
+
   impulseParameters.add(impulseRadiusParameter);
   impulseParameters.add(impulseRadialVelocityParameter);
   parameters.add(impulseParameters);
@@ -103,89 +115,157 @@ void ofApp::setup(){
   std::filesystem::create_directory(ofToDataPath("Recordings"));
   recorder.setFFmpegPathToAddonsPath();
   recorder.setInputPixelFormat(OF_IMAGE_COLOR);
+  frameRecorder.setup(Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT, Constants::FRAME_RATE, 8);
 
   ofxTimeMeasurements::instance()->setEnabled(false);
 }
 
 //--------------------------------------------------------------
-// TODO: do we need to extract these randoms?
-void drawSand(float x1, float y1, float x2, float y2, float density, float maxRadius) {
-  float dist = ofDist(x1, y1, x2, y2);
-  int grains = dist * density;
-  for (int i = 0; i < grains; i++) {
-    float pct = ofRandom(0.0, 1.0);
-    float x = ofLerp(x1, x2, pct);
-    float y = ofLerp(y1, y2, pct);
-    x += ofRandom(maxRadius*2.0) - maxRadius;
-    y += ofRandom(maxRadius*2.0) - maxRadius;
-    float r = 1.0 + ofRandom(maxRadius);
-    ofDrawCircle(x, y, r);
+// Draw the connections from each note to the next that have arrived since the last frame, into the fluid
+// or into connectionsFbo, which then goes into the fluid every frame and is redrawn from the window as
+// notes leave it
+void ofApp::drawConnections() {
+  TS_START("draw-connections");
+  bool rebuildLayer = false;
+  if (connectionsLayerParameter != connectionsLayerActive) {
+    connectionsLayerActive = connectionsLayerParameter;
+    if (connectionsLayerActive && !connectionsFbo.isAllocated()) {
+      connectionsFbo.allocate(Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT, GL_RGBA32F);
+    }
+    rebuildLayer = connectionsLayerActive;
+  }
+  // the layer holds the connections of notes that have since left the window, so redraw it once they
+  // are an eighth of the window; the grains are the same each time, so only the old connections go
+  if (connectionsLayerActive && (noteHistory.getFirstSeq() - connectionsLayerFirstSeq) * 8 > noteHistory.size()) {
+    rebuildLayer = true;
+  }
+  if (rebuildLayer) {
+    connectionsFbo.begin();
+    ofClear(0, 0);
+    connectionsFbo.end();
+    connectionsEndSeq = 0;
+    connectionsLayerFirstSeq = noteHistory.getFirstSeq();
   }
-}
 
-void ofApp::drawConnections() {
-  fluidSimulation.getFlowValuesFbo().getSource().begin();
-  ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-  float lastX = -1.0; float lastY = -1.0;
-  for (const auto [x, y] : recentNoteXYs) {
-    if (lastX > -1.0) {
-      ofFloatColor color = somColorAt(x, y); color.a = 0.05;
-      ofSetColor(color);
-      drawSand(lastX*Constants::FLUID_WIDTH, lastY*Constants::FLUID_HEIGHT, x*Constants::FLUID_WIDTH, y*Constants::FLUID_HEIGHT, 0.01, 2.0);
+  // a connection ends at each note after the oldest
+  uint64_t firstSeq = std::max(connectionsEndSeq, noteHistory.getFirstSeq() + 1);
+  uint64_t endSeq = noteHistory.getEndSeq();
+  if (firstSeq < endSeq) {
+    somColors.setBilinear(somColorBilinearParameter);
+    somColors.at(noteHistory.xys(), firstSeq - noteHistory.getFirstSeq(), endSeq - noteHistory.getFirstSeq(), connectionColors);
+    ofFbo& target = connectionsLayerActive ? connectionsFbo : fluidSimulation.getFlowValuesFbo().getSource();
+    target.begin();
+    ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+    // the layer is kept premultiplied, so it can go over the fluid as though each grain were drawn there
+    if (connectionsLayerActive) glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    for (uint64_t seq = firstSeq; seq < endSeq; seq++) {
+      const auto [lastX, lastY] = noteHistory.xy(seq - 1);
+      const auto [x, y] = noteHistory.xy(seq);
+      ofFloatColor color = connectionColors[seq - firstSeq]; color.a = 0.05;
+      connectionsSand.add(seq, { lastX*Constants::FLUID_WIDTH, lastY*Constants::FLUID_HEIGHT }, { x*Constants::FLUID_WIDTH, y*Constants::FLUID_HEIGHT }, 0.01, 2.0, color);
 //      ofDrawLine(lastX*Constants::FLUID_WIDTH, lastY*Constants::FLUID_HEIGHT, x*Constants::FLUID_WIDTH, y*Constants::FLUID_HEIGHT);
     }
-    lastX = x; lastY = y;
+    connectionsSand.draw();
+    target.end();
   }
-  fluidSimulation.getFlowValuesFbo().getSource().end();
+  connectionsEndSeq = endSeq;
+
+  if (connectionsLayerActive) {
+    fluidSimulation.getFlowValuesFbo().getSource().begin();
+    ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // premultiplied
+    ofSetColor(255);
+    connectionsFbo.draw(0.0, 0.0);
+    fluidSimulation.getFlowValuesFbo().getSource().end();
+  }
+  TS_STOP("draw-connections");
 }
 
 void ofApp::updateRecentNotes(float s, float t, float u, float v) {
   TS_START("update-recent-notes");
-  if (recentNoteXYs.size() > clusterSourceSamplesMaxParameter) {
-    // erase oldest 10% of the max
-    recentNoteXYs.erase(recentNoteXYs.begin(), recentNoteXYs.begin() + clusterSourceSamplesMaxParameter/10);
+  // evict the oldest notes to make room
+  while (noteHistory.size() >= clusterSourceSamplesMaxParameter) {
+    uint64_t oldestSeq = noteHistory.getFirstSeq();
+    if (clusterer.is_seeded()) clusterer.erase(noteHistory.xy(oldestSeq), noteHistory.label(oldestSeq));
+    noteHistory.evictOldest();
   }
-  recentNoteXYs.push_back({ s, t });
+  uint64_t seq = noteHistory.append(s, t, u, v);
+  if (clusterer.is_seeded()) {
+    noteHistory.label(seq) = clusterer.insert({ s, t });
+  } else if (!clusterMeans.empty()) {
+    noteHistory.label(seq) = dkm::predict(clusterMeans, { s, t }); // clustered by noteCoresetClusterer or clusterWorker
+  }
+  clusterMembers.add(noteHistory.label(seq), seq);
   introspector.addCircle(s, t, 1.0/Constants::WINDOW_WIDTH*5.0, ofColor::yellow, true, 30); // introspection: small yellow circle for new raw source sample
   TS_STOP("update-recent-notes");
 }
 
+dkm::clustering_parameters<float> ofApp::makeClusteringParameters() const {
+  dkm::clustering_parameters<float> params { static_cast<uint32_t>(clusterCentresParameter) };
+  params.set_random_seed(1000); // keep clusters stable
+  params.set_time_limit(std::chrono::milliseconds(clusterTimeLimitParameter));
+  return params;
+}
+
 void ofApp::updateClusters() {
-  if (recentNoteXYs.size() <= clusterCentresParameter) return;
+  if (noteHistory.size() <= clusterCentresParameter) return;
 
   TS_START("update-kmeans");
   {
-    dkm::clustering_parameters<float> params { static_cast<uint32_t>(clusterCentresParameter) };
-    params.set_random_seed(1000); // keep clusters stable
-    clusterResults = dkm::kmeans_lloyd(recentNoteXYs, params);
-    clusterResults = dkm::kmeans_lloyd(recentNoteXYs, params);
+    auto noteLabels = noteHistory.labelView();
+    if (clusterAsyncParameter) {
+      // take the latest finished result, labelling notes that arrived since its snapshot
+      const ClusterWorker::Result* result = clusterWorker.fetchResult(ofGetFrameNum());
+      if (result) {
+        const auto& [means, labels] = result->clusterResults;
+        clusterMeans = means;
+        clusterStats = result->stats;
+        uint64_t resultEndSeq = result->firstSeq + labels.size();
+        for (uint64_t seq = std::max(result->firstSeq, noteHistory.getFirstSeq()); seq < noteHistory.getEndSeq(); seq++) {
+          noteHistory.label(seq) = seq < resultEndSeq ? labels[seq - result->firstSeq] : dkm::predict(clusterMeans, noteHistory.xy(seq));
+        }
+        clusterMembers.rebuildRecent(noteHistory); // a fresh clustering permutes the labels, but drawCrystal only reads the newest notes
+      }
+      clusterWorker.submit(noteHistory.xys(), noteHistory.getFirstSeq(), makeClusteringParameters(), clusterCoresetParameter, clusterCoresetCellsParameter, ofGetFrameNum());
+      clusterer.reset(); // reseeds from the full window if clusterAsync is turned off
+    } else if (clusterCoresetParameter) {
+      clusterStats = noteCoresetClusterer.cluster(noteHistory.xys(), makeClusteringParameters(), clusterCoresetCellsParameter, clusterMeans, noteLabels);
+      clusterMembers.rebuildRecent(noteHistory);
+      clusterer.reset(); // reseeds from the full window if clusterCoreset is turned off
+    } else if (!clusterer.is_seeded() || clusterer.parameters().get_k() != static_cast<uint32_t>(clusterCentresParameter)) {
+      // cold start, and whenever k changes
+      const auto xys = noteHistory.xys();
+      clusterSeedNotes.resize(xys.size());
+      for (size_t i = 0; i < xys.size(); i++) clusterSeedNotes[i] = xys[i];
+      clusterer = dkm::kmeans_streaming<float, 2> { makeClusteringParameters() };
+      clusterer.seed(clusterSeedNotes, noteLabels, [this](const auto& data, const auto& parameters) {
+        DkmClusterResults results;
+        clusterStats = dkm::kmeans_lloyd_parallel(data, parameters, clusterThreadPool, std::get<0>(results), std::get<1>(results));
+        return results;
+      });
+      clusterMembers.rebuild(noteHistory);
+    } else {
+      // new notes were folded in as they arrived, so just keep moving the means towards convergence
+      uint64_t firstSeq = noteHistory.getFirstSeq();
+      clusterer.refine(noteHistory.xys(), noteLabels, clusterRefineSamplesParameter, [&](size_t i, uint32_t from, uint32_t to) {
+        clusterMembers.move(firstSeq + i, from, to);
+      });
+      clusterMembers.refresh(noteHistory);
+    }
+    if (clusterer.is_seeded()) clusterMeans = clusterer.means();
   }
   TS_STOP("update-kmeans");
   
   TS_START("update-clusterCentres");
   {
-    // glm::vec4 w is age
     // add to clusterCentres from new clusters
-    for (const auto& cluster : std::get<0>(clusterResults)) {
-      float x = cluster[0]; float y = cluster[1]; // replacing with a structured binding here requires c++20 for the lambda capture below
-      // find a similar existing cluster
-      auto it = std::find_if(clusterCentres.begin(),
-                             clusterCentres.end(),
-                             [x, y, this](const glm::vec4& p) {
-        return (glm::distance2(static_cast<glm::vec2>(p), {x, y}) < sameClusterToleranceParameter);
-      });
-      if (it == clusterCentres.end()) {
-        // don't have this clusterCentre so make it
-        clusterCentres.push_back({ x, y, 0.0, 5.0 }); // start at age=1
+    for (const auto& [x, y] : clusterMeans) {
+      auto match = clusterTracker.match(x, y, sameClusterToleranceParameter);
+      if (match.created) {
         introspector.addCircle(x, y, 7.0*1.0/Constants::WINDOW_WIDTH, ofColor::red, true, 10); // introspection: large red circle is new cluster centre
       } else {
         // TODO: could cull very close clusters here?
-        // close to an existing one, so move a little towards the new one
-        it->x = ofLerp(x, it->x, 0.3);
-        it->y = ofLerp(y, it->y, 0.3);
-        // existing cluster so increase its age to preserve it
-        it->w++;
-        introspector.addCircle(it->x, it->y, 2.0*1.0/Constants::WINDOW_WIDTH, ofColor::darkRed, true, 25); // introspection: smalli darkRed circle is existing cluster centre that continues to exist
+        introspector.addCircle(clusterTracker.getX(match.index), clusterTracker.getY(match.index), 2.0*1.0/Constants::WINDOW_WIDTH, ofColor::darkRed, true, 25); // introspection: smalli darkRed circle is existing cluster centre that continues to exist
       }
     }
   }
@@ -194,33 +274,45 @@ void ofApp::updateClusters() {
 
 void ofApp::decayClusters() {
   TS_START("decay-clusters");
-  for (auto& p: clusterCentres) {
-    p.w *= clusterDecayRateParameter;
-  }
-  // delete decayed clusterCentres
-  clusterCentres.erase(std::remove_if(clusterCentres.begin(),
-                                      clusterCentres.end(),
-                                      [](const glm::vec4& n) { return n.w <= 1.0; }),
-                       clusterCentres.end());
+  clusterTracker.decay(clusterDecayRateParameter); // also deletes decayed clusterCentres
   TS_STOP("decay-clusters");
 }
 
 void ofApp::updateSom(float x, float y, float z) {
   TS_START("update-som");
   double instance[3] = { static_cast<double>(x), static_cast<double>(y), static_cast<double>(z) };
+  som.setApproximateSearch(somApproximateBmuParameter, somExactFallbackRateParameter);
   som.updateMap(instance);
+  somColors.update(som, som.getLastUpdateRegion());
 
-  if (somVisible) {
-    for (int i = 0; i < Constants::SOM_WIDTH; i++) {
-      for (int j = 0; j < Constants::SOM_HEIGHT; j++) {
-        double * c = som.getMapAt(i,j);
-        ofFloatColor col(c[0], c[1], c[2]);
-        somImage.setColor(i, j, col);
+  if (somVisible) updateSomImage(som.getLastUpdateRegion());
+  TS_STOP("update-som");
+}
+
+// Convert a region of the map into somImage's pixels and upload just that rectangle of its texture
+void ofApp::updateSomImage(const SelfOrganizingMap::Region& region) {
+  const int width = som.getWidth();
+  const float* planes[3] = { som.getPlane(0), som.getPlane(1), som.getPlane(2) };
+  unsigned char* pixels = somImage.getPixels().getData();
+  for (int y = region.firstRow; y <= region.lastRow; y++) {
+    for (int x = region.firstColumn; x <= region.lastColumn; x++) {
+      size_t i = static_cast<size_t>(y) * width + x;
+      for (int c = 0; c < 3; c++) {
+        pixels[i * 3 + c] = static_cast<unsigned char>(ofClamp(planes[c][i], 0.0, 1.0) * 255.0);
       }
     }
-    somImage.update();
   }
-  TS_STOP("update-som");
+
+  const ofTextureData& textureData = somImage.getTexture().getTextureData();
+  glBindTexture(textureData.textureTarget, textureData.textureID);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+  glTexSubImage2D(textureData.textureTarget, 0, region.firstColumn, region.firstRow,
+                  region.lastColumn - region.firstColumn + 1, region.lastRow - region.firstRow + 1,
+                  GL_RGB, GL_UNSIGNED_BYTE, pixels + (static_cast<size_t>(region.firstRow) * width + region.firstColumn) * 3);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(textureData.textureTarget, 0);
 }
 
 void ofApp::drawForegroundNoteMark(float x, float y, ofFloatColor color) {
@@ -239,6 +331,55 @@ void ofApp::drawFluidNoteMark(float x, float y, ofFloatColor color) {
   fluidSimulation.getFlowValuesFbo().getSource().end();
 }
 
+// Add up everything the app allocates before allocating it, choosing the canvas layer formats to fit the budget
+void ofApp::allocateFbos() {
+  const auto& fluidTexture = fluidSimulation.getFlowValuesFbo().getSource().getTexture().getTextureData();
+  fboBudget.add("fluid values", fluidTexture.width, fluidTexture.height, fluidTexture.glInternalFormat, 2, false);
+  fboBudget.add("frozen fluid", Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT, GL_RGBA, 1, false);
+  fboBudget.add("divisions", Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, FboBudget::rgbaFormat(Constants::DIVISIONS_CHANNEL_BYTES), 2, true);
+  fboBudget.add("foreground", Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, FboBudget::rgbaFormat(Constants::FOREGROUND_CHANNEL_BYTES), 2, true);
+  fboBudget.add("crystal tiles", // as many as may be live
+                TiledLayer::tileLength(Constants::CANVAS_WIDTH, Constants::CRYSTAL_TILE_SIZE),
+                TiledLayer::tileLength(Constants::CANVAS_HEIGHT, Constants::CRYSTAL_TILE_SIZE),
+                FboBudget::rgbaFormat(Constants::CRYSTAL_CHANNEL_BYTES), 2 * Constants::CRYSTAL_MAX_TILES, true);
+  fboBudget.add("crystal mask", Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_R8, 1, false);
+  fboBudget.add("composite", Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGB, 1, false);
+  fboBudget.add("recording", Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT, GL_RGB, 1, false);
+  bool fits = fboBudget.fit(Constants::FBO_MEMORY_DOWNGRADE);
+  const std::string report = fboBudget.getReport() + "\n  (the fluid simulation's other buffers aren't counted, nor is the connections layer until it's turned on)";
+  if (!fits) {
+    ofLogFatalError("ofApp") << report;
+    std::exit(EXIT_FAILURE);
+  }
+  ofLogNotice("ofApp") << report;
+
+  frozenFluid.allocate(Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT);
+  
+  divisionsFormat = fboBudget.getFormat("divisions");
+  divisionsFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, divisionsFormat);
+  divisionsFbo.getSource().clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
+  
+  foregroundFormat = fboBudget.getFormat("foreground");
+  foregroundFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, foregroundFormat);
+  foregroundFbo.getSource().clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
+  
+  crystalFormat = fboBudget.getFormat("crystal tiles");
+  crystalLayer.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, Constants::CRYSTAL_TILE_SIZE, crystalFormat, Constants::CRYSTAL_MAX_TILES);
+  crystalMaskFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_R8);
+  maskShader.load();
+  
+  compositeFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGB);
+}
+
+// 8-bit layers stall short of fading out unless the fade is dithered
+void ofApp::fadeLayer(PingPongFbo& fbo, GLint format, float fade) {
+  if (format == GL_RGBA8) {
+    ditheredFadeShader.render(fbo, {1.0, 1.0, 1.0, fade});
+  } else {
+    fadeShader.render(fbo, {1.0, 1.0, 1.0, fade});
+  }
+}
+
 void ofApp::update() {
   introspector.update();
   
@@ -248,10 +389,11 @@ void ofApp::update() {
   fluidSimulation.update();
   TSGL_STOP("update-fluid-simulation");
   
-  fadeShader.render(crystalFbo, {1.0, 1.0, 1.0, fadeCrystalsParameter});
-  //  logisticFnShader.render(crystalFbo, glm::vec4 { 0.0, 0.0, 0.0, 1.0 });
-  fadeShader.render(divisionsFbo, {1.0, 1.0, 1.0, fadeDivisionsParameter});
-  fadeShader.render(foregroundFbo, {1.0, 1.0, 1.0, fadeForegroundParameter});
+  TSGL_START("update-fade-crystals");
+  crystalLayer.fade(fadeCrystalsParameter, [&](PingPongFbo& tile) { fadeLayer(tile, crystalFormat, fadeCrystalsParameter); });
+  TSGL_STOP("update-fade-crystals");
+  fadeLayer(divisionsFbo, divisionsFormat, fadeDivisionsParameter);
+  fadeLayer(foregroundFbo, foregroundFormat, fadeForegroundParameter);
   translateShader.render(foregroundFbo, {0.000, 0.0003});
 
   updateClusters();
@@ -277,7 +419,7 @@ void ofApp::update() {
     updateRecentNotes(s, t, u, v);
     
     updateSom(s, t, v);
-    ofFloatColor somColor = somColorAt(s, t);
+    ofFloatColor somColor = somColors.at(s, t);
     ofFloatColor darkSomColor = somColor; darkSomColor.setBrightness(0.3); darkSomColor.setSaturation(1.0);
     
     drawForegroundNoteMark(s, t, darkSomColor);
@@ -288,9 +430,9 @@ void ofApp::update() {
       foregroundFbo.getSource().begin();
       ofEnableBlendMode(OF_BLENDMODE_ALPHA);
       ofNoFill();
-      for (auto& p: clusterCentres) {
+      for (const auto& p: clusterTracker.getCentres()) {
         if (p.w < 4.0) continue;
-        ofFloatColor somColor = somColorAt(p.x, p.y);
+        ofFloatColor somColor = somColors.at(p.x, p.y);
         ofFloatColor darkSomColor = somColor; darkSomColor.setBrightness(0.6); darkSomColor.setSaturation(1.0); darkSomColor.a = 0.85;
         ofSetColor(darkSomColor);
         ofPolyline path;
@@ -306,7 +448,7 @@ void ofApp::update() {
     ofEnableBlendMode(OF_BLENDMODE_ADD);
     ofNoFill();
     ofSetColor(ofFloatColor(0.2, 0.2, 0.2, 0.6));
-    for (auto& p: clusterCentres) {
+    for (const auto& p: clusterTracker.getCentres()) {
       if (p.w < 5.0) continue;
       ofDrawCircle(p.x * Constants::FLUID_WIDTH, p.y * Constants::FLUID_HEIGHT, u * 100.0);
     }
@@ -314,10 +456,10 @@ void ofApp::update() {
     
     {
       TS_START("update-fluid-clusters");
-      for (auto& centre : clusterCentres) {
+      for (const auto& centre : clusterTracker.getCentres()) {
         float x = centre[0]; float y = centre[1];
         const float COL_FACTOR = 0.001;// 0.008;
-        ofFloatColor color = somColorAt(x, y) * COL_FACTOR; //color.a = 0.001;
+        ofFloatColor color = somColors.at(x, y) * COL_FACTOR; //color.a = 0.001;
         FluidSimulation::Impulse impulse {
           { x * Constants::FLUID_WIDTH, y * Constants::FLUID_HEIGHT },
           Constants::FLUID_WIDTH * impulseRadiusParameter,
@@ -333,123 +475,22 @@ void ofApp::update() {
     
     // Make fine structure based on frequent clusters
     TS_START("update-fine-structure");
-    if (recentNoteXYs.size() > 50) { // arbitrary threshold: "enough" samples to start this process
-      const std::vector<uint32_t>& clusteredNoteIds = std::get<1>(clusterResults);
-      
-      // find a cluster to work with
-      auto clusterId = *(clusteredNoteIds.end() - 1); // could be begin() but maybe this gets the most recent note to start from
-      
-      // find some noteIds from that cluster
-      std::vector<uint32_t> sampledClusterNoteIds;
-      for(uint32_t i = clusteredNoteIds.size() - 1; i > clusteredNoteIds.size() - sampleNotesParameter; i--) {
-        auto id = clusteredNoteIds[i];
-        if (id == clusterId) sampledClusterNoteIds.push_back(i);
-      }
-      
-      // draw crystals if we have at least a triangle
-      if (sampledClusterNoteIds.size() > 2) {
-        std::vector<glm::vec2> sampledClusterNoteXYs;
-        glm::vec2 lastXY;
-        for (uint32_t id : sampledClusterNoteIds) {
-          float x = recentNoteXYs[id][0];
-          float y = recentNoteXYs[id][1];
-          // exclude consecutive positions with same X or Y
-          glm::vec2 newXY = { x, y };
-          if (lastXY.x != x && lastXY.y != y) sampledClusterNoteXYs.push_back(newXY);
-          std::swap(lastXY, newXY);
-        }
-        
-        // make normalised path from sampled notes
-        ofPath path;
-        for (const auto p : sampledClusterNoteXYs) {
-          path.lineTo(p);
-        }
-        path.close();
-        
-        // find normalised path bounds
-        ofRectangle pathBounds;
-        for (const auto& polyline : path.getOutline()) {
-          pathBounds = pathBounds.getUnion(polyline.getBoundingBox());
-        }
-        
-        // ignore for bounds too small
-        if (pathBounds.width > 1.0/200.0) {
-          
-          // add constrained divider lines extending the path segments,
-          // and draw them into fluid layer
-          fluidSimulation.getFlowValuesFbo().getSource().begin();
-          {
-            ofPushMatrix();
-            ofScale(Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT);
-            ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-            ofSetColor(ofFloatColor(0.0, 0.0, 0.0, 0.2));
-            float width = 3.0 * 1.0 / Constants::FLUID_WIDTH;
-            for (int i = 0; i != sampledClusterNoteXYs.size(); i++) {
-              if (auto dividerLine = dividedArea.addConstrainedDividerLine(sampledClusterNoteXYs[i],
-                                                                           sampledClusterNoteXYs[(i + 1) % sampledClusterNoteXYs.size()])) {
-                dividerLine.value().draw(width);
-              }
-            };
-            ofPopMatrix();
-          }
-          fluidSimulation.getFlowValuesFbo().getSource().end();
-          
-          // paint flat filled path into the fluid layer
-          fluidSimulation.getFlowValuesFbo().getSource().begin();
-          {
-            ofPath fluidPath = path;
-            fluidPath.scale(Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT);
-            ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-            ofFloatColor fillColor = somColor; fillColor.a = 0.3;
-            fluidPath.setColor(fillColor);
-            fluidPath.setFilled(true);
-            fluidPath.draw();
-          }
-          fluidSimulation.getFlowValuesFbo().getSource().end();
-          
-          // paint masked frozen fluid onto crystal layer
-          if (frozenFluid.isAllocated()) {
-            
-            // make a mask texture
-            crystalMaskFbo.begin();
-            {
-              ofPath maskPath = path;
-              ofEnableBlendMode(OF_BLENDMODE_DISABLED);
-              ofClear(0, 255);
-              ofSetColor(255);
-              maskPath.setFilled(true);
-              maskPath.scale(crystalMaskFbo.getWidth(), crystalMaskFbo.getHeight());
-              maskPath.draw();
-            }
-            crystalMaskFbo.end();
-            
-            // find a proportional scale to some limit to fill the mask with a reduced view of part of the frozen fluid
-            constexpr float MAX_SCALE = 3.0;
-            float scaleX = std::fminf(MAX_SCALE, 1.0 / pathBounds.width);
-            float scaleY = std::fminf(MAX_SCALE, 1.0 / pathBounds.height);
-            float scale = std::fminf(scaleX, scaleY);
-            
-            // draw scaled, coloured frozen fluid into the crystal layer through the mask
-            crystalFbo.getSource().begin();
-            {
-              ofEnableBlendMode(OF_BLENDMODE_ADD);
-              ofFloatColor fragmentColor = somColorAt(pathBounds.x, pathBounds.y)*0.1;
-              ofSetColor(fragmentColor);
-              maskShader.render(frozenFluid, crystalMaskFbo,
-                                crystalFbo.getWidth(), crystalFbo.getHeight(),
-                                false,
-                                {pathBounds.x+pathBounds.width/2.0, pathBounds.y+pathBounds.height/2.0},
-                                {scale, scale});
-            }
-            crystalFbo.getSource().end();
-          }
-        }
+    uint64_t newestSeq = noteHistory.getEndSeq() - 1;
+    if (noteHistory.size() > 50 && noteHistory.label(newestSeq) != NoteHistory::noLabel) { // arbitrary threshold: "enough" samples to start this process
+      // find clusters to work with, from the most recent notes (which could be the oldest but maybe this gets the most recent note to start from)
+      crystalClusterIds.clear();
+      uint64_t firstSeq = noteHistory.getEndSeq() - std::min<uint64_t>(sampleNotesParameter, noteHistory.size());
+      for (uint64_t seq = newestSeq + 1; seq-- > firstSeq && crystalClusterIds.size() < static_cast<size_t>(crystalsPerNoteParameter);) {
+        uint32_t clusterId = noteHistory.label(seq);
+        if (clusterId == NoteHistory::noLabel) continue;
+        if (std::find(crystalClusterIds.begin(), crystalClusterIds.end(), clusterId) == crystalClusterIds.end()) crystalClusterIds.push_back(clusterId);
       }
+      for (uint32_t clusterId : crystalClusterIds) drawCrystal(clusterId, somColor);
     }
     TS_STOP("update-fine-structure");
     
     TS_START("update-divider");
-    bool majorDividersChanged = dividedArea.updateUnconstrainedDividerLines(clusterCentres);
+    bool majorDividersChanged = dividedArea.updateUnconstrainedDividerLines(clusterTracker.getCentres());
     if (majorDividersChanged) {
       TS_START("update-divider-draw-fluid");
       fluidSimulation.getFlowValuesFbo().getSource().begin();
@@ -465,17 +506,14 @@ void ofApp::update() {
       }
       fluidSimulation.getFlowValuesFbo().getSource().end();
       TS_STOP("update-divider-draw-fluid");
-      
-      TS_START("update-divider-fetch-frozen");
-      // fetching pixels from gpu is slow
-      if (ofGetFrameNum() % 60 == 0.0) {
-        ofPixels frozenPixels;
-        fluidSimulation.getFlowValuesFbo().getSource().getTexture().readToPixels(frozenPixels);
-        frozenFluid.allocate(frozenPixels);
-      }
-      TS_STOP("update-divider-fetch-frozen");
     }
     TS_STOP("update-divider");
+
+    TSGL_START("update-frozen-fluid");
+    if (ofGetFrameNum() % frozenFluidIntervalParameter == 0) {
+      frozenFluid.capture(fluidSimulation.getFlowValuesFbo().getSource());
+    }
+    TSGL_STOP("update-frozen-fluid");
     
   } //isDataValid()
   
@@ -502,9 +540,109 @@ void ofApp::update() {
   }
 }
 
-ofFloatColor ofApp::somColorAt(float x, float y) const {
-  double* somValue = som.getMapAt(x * Constants::SOM_WIDTH, y * Constants::SOM_HEIGHT);
-  return ofFloatColor(somValue[0], somValue[1], somValue[2], 1.0);
+// Draw a crystal from the latest notes of a cluster: a filled polygon in the fluid, and frozen fluid seen through it in the crystal layer
+void ofApp::drawCrystal(uint32_t clusterId, ofFloatColor somColor) {
+  // find some notes from that cluster among the most recent
+  uint64_t firstSampledSeq = noteHistory.getEndSeq() - std::min<uint64_t>(sampleNotesParameter - 1, noteHistory.getEndSeq());
+  clusterMembers.latest(noteHistory, clusterId, firstSampledSeq, sampleNotesParameter, sampledClusterNoteSeqs);
+
+  // draw crystals if we have at least a triangle
+  if (sampledClusterNoteSeqs.size() <= 2) return;
+  sampledClusterNoteXYs.clear();
+  glm::vec2 lastXY;
+  for (uint64_t seq : sampledClusterNoteSeqs) {
+    const auto [x, y] = noteHistory.xy(seq);
+    // exclude consecutive positions with same X or Y
+    glm::vec2 newXY = { x, y };
+    if (lastXY.x != x && lastXY.y != y) sampledClusterNoteXYs.push_back(newXY);
+    std::swap(lastXY, newXY);
+  }
+  if (sampledClusterNoteXYs.empty()) return;
+
+  // find normalised path bounds
+  glm::vec2 minXY = sampledClusterNoteXYs.front(), maxXY = minXY;
+  for (const auto& p : sampledClusterNoteXYs) {
+    minXY = glm::min(minXY, p);
+    maxXY = glm::max(maxXY, p);
+  }
+  ofRectangle pathBounds { minXY.x, minXY.y, maxXY.x - minXY.x, maxXY.y - minXY.y };
+
+  // ignore for bounds too small
+  if (pathBounds.width <= 1.0/200.0) return;
+
+  // tessellate the normalised path once, to draw at each size with a transform
+  crystalOutline.clear();
+  for (const auto& p : sampledClusterNoteXYs) crystalOutline.addVertex(p.x, p.y);
+  crystalOutline.close();
+  crystalTessellator.tessellateToMesh(crystalOutline, OF_POLY_WINDING_ODD, crystalMesh, true);
+
+  // add constrained divider lines extending the path segments,
+  // and draw them into fluid layer
+  fluidSimulation.getFlowValuesFbo().getSource().begin();
+  {
+    ofPushMatrix();
+    ofScale(Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT);
+    ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+    ofSetColor(ofFloatColor(0.0, 0.0, 0.0, 0.2));
+    float width = 3.0 * 1.0 / Constants::FLUID_WIDTH;
+    for (int i = 0; i != sampledClusterNoteXYs.size(); i++) {
+      if (auto dividerLine = dividedArea.addConstrainedDividerLine(sampledClusterNoteXYs[i],
+                                                                   sampledClusterNoteXYs[(i + 1) % sampledClusterNoteXYs.size()])) {
+        dividerLine.value().draw(width);
+      }
+    };
+    ofPopMatrix();
+  }
+  fluidSimulation.getFlowValuesFbo().getSource().end();
+
+  // paint flat filled path into the fluid layer
+  fluidSimulation.getFlowValuesFbo().getSource().begin();
+  {
+    ofPushMatrix();
+    ofScale(Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT);
+    ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+    ofFloatColor fillColor = somColor; fillColor.a = 0.3;
+    ofSetColor(fillColor);
+    crystalMesh.draw();
+    ofPopMatrix();
+  }
+  fluidSimulation.getFlowValuesFbo().getSource().end();
+
+  // paint masked frozen fluid onto crystal layer
+  if (!frozenFluid.isAllocated()) return;
+
+  // make a mask texture
+  crystalMaskFbo.begin();
+  {
+    ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+    ofClear(0, 255);
+    ofSetColor(255);
+    ofPushMatrix();
+    ofScale(crystalMaskFbo.getWidth(), crystalMaskFbo.getHeight());
+    crystalMesh.draw();
+    ofPopMatrix();
+  }
+  crystalMaskFbo.end();
+
+  // find a proportional scale to some limit to fill the mask with a reduced view of part of the frozen fluid
+  constexpr float MAX_SCALE = 3.0;
+  float scaleX = std::fminf(MAX_SCALE, 1.0 / pathBounds.width);
+  float scaleY = std::fminf(MAX_SCALE, 1.0 / pathBounds.height);
+  float scale = std::fminf(scaleX, scaleY);
+
+  // draw scaled, coloured frozen fluid into the crystal layer through the mask, in the tiles under the path;
+  // the frozen fluid and the mask are at most 1, so nothing adds more than the colour
+  ofFloatColor fragmentColor = somColors.at(pathBounds.x, pathBounds.y)*0.1;
+  float addedBound = std::max({ fragmentColor.r, fragmentColor.g, fragmentColor.b, fragmentColor.a });
+  crystalLayer.draw(pathBounds, addedBound, [&]() {
+    ofEnableBlendMode(OF_BLENDMODE_ADD);
+    ofSetColor(fragmentColor);
+    maskShader.render(frozenFluid.getTexture(), crystalMaskFbo,
+                      crystalLayer.getWidth(), crystalLayer.getHeight(),
+                      false,
+                      {pathBounds.x+pathBounds.width/2.0, pathBounds.y+pathBounds.height/2.0},
+                      {scale, scale});
+  });
 }
 
 //--------------------------------------------------------------
@@ -530,7 +668,7 @@ ofFbo ofApp::drawComposite() {
   {
     ofEnableBlendMode(OF_BLENDMODE_ALPHA);
     ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
-    crystalFbo.draw(0, 0, Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT);
+    crystalLayer.draw(0, 0, Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT);
   }
   
   // divisions
@@ -548,11 +686,14 @@ void ofApp::draw() {
   drawComposite().draw(0.0, 0.0, Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT);
   
   // video recording
-  if (recorder.isRecording()) {
-    ofPixels pixels;
-    compositeFbo.readToPixels(pixels);
-    pixels.resize(Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT);
-    recorder.addFrame(pixels);
+  if (recorder.isRecording()) frameRecorder.addFrame(compositeFbo);
+
+  // snapshot
+  snapshotWriter.update();
+  if (snapshotRequested) {
+    snapshotWriter.capture(compositeFbo, ofFilePath::getUserHomeDir()+"/Documents/bells3/snapshot-"+ofGetTimestampString(),
+                           static_cast<SnapshotWriter::Format>(snapshotFormatParameter.get()), snapshotPngLevelParameter);
+    snapshotRequested = false;
   }
   
   if (somVisible) somImage.draw(0, 0, Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT);
@@ -583,7 +724,16 @@ void ofApp::draw() {
   }
 
   // gui
-  if (guiVisible) gui.draw();
+  if (guiVisible) {
+    gui.draw();
+    float statsY = gui.getShape().getBottom() + 20;
+    ofDrawBitmapString(toString(clusterStats), gui.getPosition().x, statsY);
+    if (clusterAsyncParameter) ofDrawBitmapString(clusterWorker.getStatsString(), gui.getPosition().x, statsY + 20);
+    if (somApproximateBmuParameter) ofDrawBitmapString(toString(som.getSearchStats()), gui.getPosition().x, statsY + 40);
+    if (recorder.isRecording()) ofDrawBitmapString(frameRecorder.getStatsString(), gui.getPosition().x, statsY + 60);
+    ofDrawBitmapString(snapshotWriter.getStatsString(), gui.getPosition().x, statsY + 80);
+    ofDrawBitmapString(crystalLayer.getStatsString(), gui.getPosition().x, statsY + 100);
+  }
 }
 
 //--------------------------------------------------------------
@@ -594,16 +744,22 @@ void ofApp::exit(){
 void ofApp::startRecording() {
   recorder.setOutputPath(ofToDataPath("Recordings/" + ofGetTimestampString() + ".mp4", true ));
   recorder.startCustomRecord();
+  frameRecorder.resetStats();
 }
 
 void ofApp::stopRecording() {
+  frameRecorder.flush();
   recorder.stop();
 }
 
 void ofApp::keyPressed(int key){
   if (audioAnalysisClientPtr->keyPressed(key)) return;
   if (key == OF_KEY_TAB) guiVisible = not guiVisible;
-  if (key == 'M') somVisible = not somVisible;
+  if (key == 'M') {
+    somVisible = not somVisible;
+    // the image isn't kept up to date while hidden
+    if (somVisible) updateSomImage({ 0, 0, som.getWidth() - 1, som.getHeight() - 1 });
+  }
   {
     float plotHeight = ofGetWindowHeight() / 4.0;
     int plotIndex = ofGetMouseY() / plotHeight;
@@ -612,11 +768,7 @@ void ofApp::keyPressed(int key){
     if (plotKeyPressed || spectrumPlotKeyPressed) return;
   }
   if (introspector.keyPressed(key)) return;
-  if (key == 'S') {
-    ofPixels pixels;
-    drawComposite().readToPixels(pixels);
-    ofSaveImage(pixels, ofFilePath::getUserHomeDir()+"/Documents/bells3/snapshot-"+ofGetTimestampString()+".png", OF_IMAGE_QUALITY_BEST);
-  }
+  if (key == 'S') snapshotRequested = true;
   if (key == 'R') {
     if (recorder.isRecording()) {
       stopRecording();
@@ -2,20 +2,30 @@
 
 #include "ofMain.h"
 #include "ofxGui.h"
-#include "ofxSelfOrganizingMap.h"
 #include "ofxAudioAnalysisClient.h"
 #include "ofxAudioData.h"
 #include "FluidSimulation.h"
 #include "MaskShader.h"
 #include "MultiplyColorShader.h"
+#include "DitheredFadeShader.h"
 #include "TranslateShader.h"
 #include "LogisticFnShader.h"
 #include "ofxIntrospector.h"
 #include "Constants.h"
 #include "ofxDividedArea.h"
 #include "ofxFFmpegRecorder.h"
-
-using DkmClusterResults = std::tuple<std::vector<std::array<float, 2>>, std::vector<uint32_t>>; // (x,y),id
+#include "ClusterWorker.h"
+#include "NoteHistory.h"
+#include "ClusterMemberIndex.h"
+#include "ClusterTracker.h"
+#include "SelfOrganizingMap.h"
+#include "SomColorTable.h"
+#include "Sand.h"
+#include "FrozenFluid.h"
+#include "FrameRecorder.h"
+#include "SnapshotWriter.h"
+#include "FboBudget.h"
+#include "TiledLayer.h"
 
 class ofApp : public ofBaseApp{
   
@@ -45,13 +55,18 @@ private:
   void drawConnections();
   void updateRecentNotes(float s, float t, float u, float v);
   void updateClusters();
+  dkm::clustering_parameters<float> makeClusteringParameters() const;
   void decayClusters();
   void updateSom(float x, float y, float z);
+  void updateSomImage(const SelfOrganizingMap::Region& region);
   void drawForegroundNoteMark(float x, float y, ofFloatColor color);
   void drawFluidNoteMark(float x, float y, ofFloatColor color);
   void drawForegroundClusterMarks(float x, float y, ofFloatColor color);
   void drawFluidClusterMarks(float x, float y, ofFloatColor color);
+  void drawCrystal(uint32_t clusterId, ofFloatColor somColor);
   ofFbo drawComposite();
+  void allocateFbos();
+  void fadeLayer(PingPongFbo& fbo, GLint format, float fade);
 
   void startRecording();
   void stopRecording();
@@ -61,36 +76,65 @@ private:
   std::shared_ptr<ofxAudioData::Plots> audioDataPlotsPtr;
   std::shared_ptr<ofxAudioData::SpectrumPlots> audioDataSpectrumPlotsPtr;
 
-  ofxSelfOrganizingMap som;
-  ofFloatColor somColorAt(float x, float y) const;
-  bool somVisible;
-  ofImage somImage;
+  dkm::thread_pool workerThreadPool; // for work split up within the frame
+  SelfOrganizingMap som { workerThreadPool };
+  SomColorTable somColors; // follows som
+  std::vector<ofFloatColor> connectionColors;
+  bool somVisible { false };
+  ofImage somImage; // only kept up to date while somVisible
 
   MultiplyColorShader fadeShader;
+  DitheredFadeShader ditheredFadeShader; // for 8-bit layers
   TranslateShader translateShader;
   LogisticFnShader logisticFnShader;
 
   FluidSimulation fluidSimulation;
-  ofTexture frozenFluid;
-
+  uint64_t connectionsEndSeq { 0 }; // notes before this have had their connections drawn
+  Sand connectionsSand { workerThreadPool };
+  ofFbo connectionsFbo; // the connections of the recent notes, for connectionsLayer; allocated when that's first turned on
+  uint64_t connectionsLayerFirstSeq { 0 }; // connectionsFbo has the connections of the notes from here on
+  bool connectionsLayerActive { false };
+  FrozenFluid frozenFluid;
+
+  FboBudget fboBudget { Constants::FBO_MEMORY_BUDGET_MB * 1024 * 1024 };
   PingPongFbo foregroundFbo; // transient lines and circles
+  GLint foregroundFormat;
   
-  PingPongFbo crystalFbo;
+  TiledLayer crystalLayer; // only where there are crystals
+  GLint crystalFormat;
   ofFbo crystalMaskFbo;
   MaskShader maskShader;
   
   PingPongFbo divisionsFbo;
+  GLint divisionsFormat;
   DividedArea dividedArea { {1.0, 1.0}, 5 };
 
-  std::vector<std::array<float, 2>> recentNoteXYs;
-  DkmClusterResults clusterResults;
-  std::vector<glm::vec4> clusterCentres;
+  NoteHistory noteHistory; // recent notes, clustered on (s, t), with their cluster labels
+  std::vector<std::array<float, 2>> clusterMeans;
+  std::vector<std::array<float, 2>> clusterSeedNotes; // reused to pack the notes for a cold start
+  ClusterMemberIndex clusterMembers; // recent notes of each cluster, kept up to date with the labels in noteHistory
+  std::vector<uint32_t> crystalClusterIds;
+  std::vector<uint64_t> sampledClusterNoteSeqs;
+  std::vector<glm::vec2> sampledClusterNoteXYs;
+  ofPolyline crystalOutline;
+  ofTessellator crystalTessellator;
+  ofMesh crystalMesh; // the latest crystal, normalised
+  dkm::kmeans_streaming<float, 2> clusterer { dkm::clustering_parameters<float> { 0 } }; // warm-started from the previous frame's means
+  dkm::thread_pool clusterThreadPool;
+  NoteCoresetClusterer noteCoresetClusterer; // alternative to clusterer
+  ClusterWorker clusterWorker { clusterThreadPool }; // alternative to both, off the render thread
+  dkm::clustering_stats clusterStats {}; // from the last full clustering
+  ClusterTracker clusterTracker; // clusterCentres
 
   ofFbo compositeFbo;
 
   Introspector introspector; // add things to this in normalised coords
   
   ofxFFmpegRecorder recorder;
+  FrameRecorder frameRecorder { recorder }; // feeds recorder from its own thread
+  dkm::thread_pool snapshotThreadPool { 2 }; // small, so writing a snapshot leaves cores for the frame
+  SnapshotWriter snapshotWriter { snapshotThreadPool };
+  bool snapshotRequested { false }; // taken from the next composite
   
   bool guiVisible { false };
   ofxPanel gui;
@@ -112,17 +156,36 @@ private:
   ofParameterGroup clusterParameters { "cluster" };
   ofParameter<int> clusterCentresParameter { "clusterCentres", 17, 2, 60 };
   ofParameter<int> clusterSourceSamplesMaxParameter { "clusterSourceSamplesMax", 12000, 1000, 48000 }; // Note: 1600 raw samples per frame at 30fps
+  ofParameter<int> clusterRefineSamplesParameter { "clusterRefineSamples", 2000, 0, 48000 }; // samples re-assigned to the moving means each frame
+  ofParameter<bool> clusterCoresetParameter { "clusterCoreset", false }; // cluster a grid summary of all notes every frame instead of refining
+  ofParameter<int> clusterCoresetCellsParameter { "clusterCoresetCells", 64, 8, 256 }; // grid cells per side for clusterCoreset
+  ofParameter<int> clusterTimeLimitParameter { "clusterTimeLimitMs", 15, 1, 100 }; // stop full clusterings early to hold the frame rate
+  ofParameter<bool> clusterAsyncParameter { "clusterAsync", false }; // cluster snapshots of the notes on clusterWorker, using the latest finished result
   ofParameter<float> clusterDecayRateParameter { "clusterDecayRate", 0.98, 0.0, 1.0 };
   ofParameter<float> sameClusterToleranceParameter { "sameClusterTolerance", 0.4, 0.01, 1.0 };
 
   ofParameterGroup crystalParameters { "crystal" };
-  ofParameter<int> sampleNotesParameter { "sampleNotes", 50, 5, 200 };
+  ofParameter<int> sampleNotesParameter { "sampleNotes", 50, 5, 1000 };
+  ofParameter<int> crystalsPerNoteParameter { "crystalsPerNote", 1, 1, 8 }; // for the clusters of the most recent notes
+  ofParameter<int> frozenFluidIntervalParameter { "frozenFluidInterval", 60, 1, 600 }; // frames between captures of the fluid for the crystals
+
+  ofParameterGroup connectionParameters { "connections" };
+  ofParameter<bool> connectionsLayerParameter { "connectionsLayer", false }; // blend all connections into the fluid every frame, not just the new ones
 
   ofParameterGroup fadeParameters { "fade" };
   ofParameter<float> fadeCrystalsParameter { "fadeCrystals", 0.9975, 0.9, 1.0 };
   ofParameter<float> fadeDivisionsParameter { "fadeDivisions", 0.9, 0.8, 1.0 };
   ofParameter<float> fadeForegroundParameter { "fadeForeground", 0.996, 0.9, 1.0 };
   
+  ofParameterGroup somParameters { "som" };
+  ofParameter<bool> somApproximateBmuParameter { "somApproximateBmu", false }; // coarse to fine search for the best matching unit
+  ofParameter<float> somExactFallbackRateParameter { "somExactFallbackRate", 0.05, 0.0, 1.0 }; // fraction of approximate searches checked against the exact one
+  ofParameter<bool> somColorBilinearParameter { "somColorBilinear", false }; // blend the nearest nodes' colours rather than taking the nearest
+
+  ofParameterGroup snapshotParameters { "snapshot" };
+  ofParameter<int> snapshotFormatParameter { "snapshotFormat", 0, 0, 2 }; // png, uncompressed tiff, ppm
+  ofParameter<int> snapshotPngLevelParameter { "snapshotPngLevel", 6, 0, 9 }; // zlib compression level
+
   ofParameterGroup impulseParameters { "impulse" };
   ofParameter<float> impulseRadiusParameter { "impulseRadius", 0.085, 0.01, 0.2 };
   ofParameter<float> impulseRadialVelocityParameter { "impulseRadialVelocity", 0.0005, 0.0001, 0.001 };
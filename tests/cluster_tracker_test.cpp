@@ -0,0 +1,52 @@
+// Tests for ClusterTracker; see tests/Makefile.
+
+#include "ClusterTracker.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      std::exit(1); \
+    } \
+  } while (false)
+
+namespace {
+
+// The app decays every frame, including those before there are enough notes to cluster
+void decayBeforeMatch() {
+  ClusterTracker tracker;
+  tracker.decay(0.9);
+  tracker.decay(0.9);
+  CHECK(tracker.size() == 0);
+  CHECK(tracker.getCentres().empty());
+
+  auto first = tracker.match(0.5, 0.5, 0.01);
+  CHECK(first.created);
+  tracker.decay(0.9);
+  CHECK(tracker.size() == 1);
+  CHECK(tracker.getCentres().size() == 1);
+
+  auto again = tracker.match(0.52, 0.5, 0.01);
+  CHECK(!again.created);
+  CHECK(again.index == first.index);
+}
+
+void faded() {
+  ClusterTracker tracker;
+  tracker.match(0.2, 0.2, 0.01);
+  for (int i = 0; i < 100; i++) tracker.decay(0.5);
+  CHECK(tracker.size() == 0);
+  CHECK(tracker.match(0.2, 0.2, 0.01).created);
+}
+
+}
+
+int main() {
+  decayBeforeMatch();
+  faded();
+  std::printf("cluster_tracker_test: ok\n");
+  return 0;
+}